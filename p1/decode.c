@@ -8,19 +8,176 @@
  * 
  * The number of right shifts required to decode the message is calculated
  * using a (not so) secret key, the CS login of the intended recipient.
+ *
+ * The shift itself runs 32 (AVX2) or 16 (SSE2) bytes at a time on x86 CPUs
+ * that support it, picked at run time, with the same output as the
+ * byte-by-byte loop.
+ *
+ * Batch mode, "decode -k <login> [file|-]", takes the key from the command
+ * line and decodes a whole file of any size, or stdin, to stdout in fixed
+ * size chunks, in constant memory. Regular files are mapped with mmap a
+ * window at a time and copied out a chunk at a time, anything else is read
+ * chunk by chunk.
+ *
+ * Pipeline mode decodes many files at once with a pool of threads, each
+ * reading, decoding and writing its own file, so the reads, decoding and
+ * writes of different files overlap. The files and logins come from a
+ * manifest (-m) of "file login" lines, or from a directory (-d) whose files
+ * are decoded with the -k login or, without -k, with the login their name
+ * starts with (alice.txt for alice). Plaintexts go to <file>.plain, or into
+ * the -o directory, and files/sec and MB/sec are reported at the end.
+ *
+ * Analysis mode, "decode -a [-c corpus] [file|-]", is for when the login is
+ * unknown: it counts the letters of the ciphertext once and ranks all 25
+ * shifts by the chi-squared distance of the shifted counts from English
+ * letter frequencies, or from those of a plaintext corpus.
+ *
+ * Build: gcc -O2 -pthread -o decode decode.c
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DECODE_X86
+#endif
 
 char * read_cipher_file(); 
 char * get_login_key();  
 char * decode(char *cipher, char *key); 
 int    calculate_shifts(char *key);  
+void   decode_bytes(char *buf, size_t len, int shifts);
+void   decode_bytes_scalar(char *buf, size_t len, int shifts);
+void   count_letters_scalar(const char *data, size_t len, unsigned long long letters[26]);
+#ifdef DECODE_X86
+void   decode_bytes_sse2(char *buf, size_t len, int shifts);
+void   decode_bytes_avx2(char *buf, size_t len, int shifts);
+void   count_letters_avx2(const char *data, size_t len, unsigned long long letters[26]);
+#endif
+long long decode_file(char *path, int out, int shifts, char *chunk);
+void   rank_shifts(char *path, char *corpus, int top);
+void   run_pipeline(char *manifest, char *dir, char *login, char *out_dir, int threads);
+void   print_usage(char *argv[]);
+
+// Bytes decoded at a time in batch mode: small enough to stay in L2
+#define CHUNK_SIZE (256 << 10)
+
+// Bytes of a regular file mapped at a time in batch mode
+#define MAP_WINDOW (64 << 20)
+
+// Called with each piece of a file read by scan_file()
+typedef void (*chunk_fn_t)(const char *data, size_t len, void *arg);
 
 int main(int argc, char *argv[]) {      
 
+	// Batch mode: the key comes from -k and the ciphertext from a file or stdin
+	// Pipeline mode: many files from a manifest (-m) or a directory (-d)
+	char *login = NULL;
+	char *manifest = NULL;
+	char *dir = NULL;
+	char *out_dir = NULL;
+	int threads = 0; // 0 until -j, then all cores
+	// Analysis mode: rank the shifts (-a), against a corpus (-c)
+	int analyze = 0;
+	char *corpus = NULL;
+	int top = 0; // 0 until -n, then all 25
+	int c;
+	while ((c = getopt(argc, argv, "k:m:d:o:j:ac:n:h")) != -1) {
+		switch (c) {
+			case 'a':
+				analyze = 1;
+				break;
+			case 'c':
+				corpus = optarg;
+				break;
+			case 'n':
+				top = atoi(optarg);
+				if (top < 1) {
+					print_usage(argv);
+					exit(1);
+				}
+				break;
+			case 'k':
+				login = optarg;
+				break;
+			case 'm':
+				manifest = optarg;
+				break;
+			case 'd':
+				dir = optarg;
+				break;
+			case 'o':
+				out_dir = optarg;
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				if (threads < 1) {
+					print_usage(argv);
+					exit(1);
+				}
+				break;
+			case 'h':
+				print_usage(argv);
+				exit(0);
+			default:
+				print_usage(argv);
+				exit(1);
+		}
+	}
+	// Each option belongs to one mode; mixing modes is an error
+	int pipeline = manifest != NULL || dir != NULL;
+	if ((analyze && (login != NULL || pipeline || out_dir != NULL || threads != 0))
+			|| (!analyze && (corpus != NULL || top != 0))
+			|| (!pipeline && (out_dir != NULL || threads != 0))) {
+		print_usage(argv);
+		exit(1);
+	}
+
+	if (analyze) {
+		if (argc - optind > 1) {
+			print_usage(argv);
+			exit(1);
+		}
+		rank_shifts(optind < argc ? argv[optind] : "-", corpus, top ? top : 25);
+		return 0;
+	}
+	if (pipeline) {
+		if ((manifest != NULL && dir != NULL) || optind < argc) {
+			print_usage(argv);
+			exit(1);
+		}
+		if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+		run_pipeline(manifest, dir, login, out_dir, threads);
+		return 0;
+	}
+	if (login != NULL) {
+		if (argc - optind > 1) {
+			print_usage(argv);
+			exit(1);
+		}
+		char *chunk = malloc(CHUNK_SIZE);
+		if (chunk == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+		decode_file(optind < argc ? argv[optind] : "-", STDOUT_FILENO, calculate_shifts(login), chunk);
+		free(chunk);
+		return 0;
+	}
+	if (optind < argc) {
+		print_usage(argv);
+		exit(1);
+	}
+
 	// Read cipher-text from cipher file
 	char *cipher = read_cipher_file();
 	printf("Your cipher text:\n%s\n", cipher);
@@ -95,8 +252,19 @@ char * decode(char *cipher, char *key) {
 	int shifts = calculate_shifts(key);
 
 	// Decode by right shifting every lowercase alphabet letter in the ciphertext
-	char *p = cipher;
-	for ( ; *p != '\0'; ++p) {
+	decode_bytes(cipher, strlen(cipher), shifts);
+
+	return cipher; // which is now decoded into plaintext
+}        
+
+/*
+ * Right shifts every lowercase letter of the "len" bytes at "buf" by
+ * "shifts" (0-25), one byte at a time.
+ */
+void decode_bytes_scalar(char *buf, size_t len, int shifts) {
+
+	char *p = buf;
+	for ( ; p < buf + len; ++p) {
 		// Skip decoding if not a lowercase letter (a-z)
 		if (*p < 'a' || *p > 'z') continue;
 
@@ -112,9 +280,96 @@ char * decode(char *cipher, char *key) {
         // back to the ASCII code for the decoded letter
 		*p = new_offset_from_a + 'a';
 	}
+}
 
-	return cipher; // which is now decoded into plaintext
-}        
+#ifdef DECODE_X86
+/*
+ * The same as decode_bytes_scalar(), 16 bytes at a time with SSE2. Bytes
+ * are compared unsigned after subtracting 'a', so only a-z land in 0-25;
+ * those get the shift added and 26 taken off again where the sum reached
+ * 26, and every other byte is kept as it was.
+ */
+__attribute__((target("sse2")))
+void decode_bytes_sse2(char *buf, size_t len, int shifts) {
+
+	const __m128i a = _mm_set1_epi8('a');
+	const __m128i last = _mm_set1_epi8(25);
+	const __m128i wrap = _mm_set1_epi8(26);
+	const __m128i shift = _mm_set1_epi8(shifts);
+	size_t i = 0;
+
+	for ( ; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i *) (buf + i));
+		__m128i offset = _mm_sub_epi8(x, a);
+		__m128i lower = _mm_cmpeq_epi8(_mm_min_epu8(offset, last), offset);
+		__m128i sum = _mm_add_epi8(offset, shift);
+		__m128i over = _mm_cmpeq_epi8(_mm_max_epu8(sum, wrap), sum);
+		sum = _mm_add_epi8(_mm_sub_epi8(sum, _mm_and_si128(over, wrap)), a);
+		x = _mm_or_si128(_mm_and_si128(lower, sum), _mm_andnot_si128(lower, x));
+		_mm_storeu_si128((__m128i *) (buf + i), x);
+	}
+	decode_bytes_scalar(buf + i, len - i, shifts);
+}
+
+/*
+ * The same as decode_bytes_sse2(), 32 bytes at a time with AVX2.
+ */
+__attribute__((target("avx2")))
+void decode_bytes_avx2(char *buf, size_t len, int shifts) {
+
+	const __m256i a = _mm256_set1_epi8('a');
+	const __m256i last = _mm256_set1_epi8(25);
+	const __m256i wrap = _mm256_set1_epi8(26);
+	const __m256i shift = _mm256_set1_epi8(shifts);
+	size_t i = 0;
+
+	for ( ; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((__m256i *) (buf + i));
+		__m256i offset = _mm256_sub_epi8(x, a);
+		__m256i lower = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, last), offset);
+		__m256i sum = _mm256_add_epi8(offset, shift);
+		__m256i over = _mm256_cmpeq_epi8(_mm256_max_epu8(sum, wrap), sum);
+		sum = _mm256_add_epi8(_mm256_sub_epi8(sum, _mm256_and_si256(over, wrap)), a);
+		x = _mm256_blendv_epi8(x, sum, lower);
+		_mm256_storeu_si256((__m256i *) (buf + i), x);
+	}
+	decode_bytes_sse2(buf + i, len - i, shifts);
+}
+#endif
+
+// The versions decode_bytes() and count_letters_chunk() use, picked once by
+// pick_impls() even when pipeline threads get there at the same time
+void (*decode_impl)(char *, size_t, int) = decode_bytes_scalar;
+void (*count_impl)(const char *, size_t, unsigned long long *);
+pthread_once_t impls_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Picks the widest versions of the decoding and letter counting loops the
+ * CPU supports.
+ */
+void pick_impls(void) {
+
+	count_impl = count_letters_scalar;
+#ifdef DECODE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		decode_impl = decode_bytes_avx2;
+		count_impl = count_letters_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		decode_impl = decode_bytes_sse2;
+	}
+#endif
+}
+
+/*
+ * Right shifts every lowercase letter of the "len" bytes at "buf" by
+ * "shifts" (0-25) with the widest version the CPU supports.
+ */
+void decode_bytes(char *buf, size_t len, int shifts) {
+
+	pthread_once(&impls_once, pick_impls);
+	decode_impl(buf, len, shifts);
+}
 
 /*
  * Calculate and return the number of shifts(1-25) needed in the Caesar cipher
@@ -129,7 +384,595 @@ int calculate_shifts(char * key) {
 	shifts = abs(shifts % 26);
 	if (shifts == 0) shifts = 1;
 	return shifts;
-}    
+}
+
+/*
+ * Writes all "len" bytes at "buf" to "fd", retrying short writes.
+ */
+void write_all(int fd, const char *buf, size_t len) {
+
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			fprintf(stderr, "Error writing plaintext.\n");
+			exit(1);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Reads the file at "path" ("-" for stdin) and passes it to "fn" in pieces
+ * of at most CHUNK_SIZE bytes, with "arg". Returns the number of bytes read.
+ */
+long long scan_file(char *path, char *chunk, chunk_fn_t fn, void *arg) {
+
+	int in = STDIN_FILENO;
+	if (strcmp(path, "-") != 0) {
+		in = open(path, O_RDONLY);
+		if (in < 0) {
+			fprintf(stderr, "Cannot open %s for reading.\n", path);
+			exit(1);
+		}
+	}
+
+	// Regular files: map them MAP_WINDOW bytes at a time and hand out pieces
+	// of the page cache, which saves a read() per chunk and keeps the mapped
+	// part of a huge file bounded
+	struct stat st;
+	off_t off = 0;
+	if (fstat(in, &st) == 0 && S_ISREG(st.st_mode)) {
+		for ( ; off < st.st_size; off += MAP_WINDOW) {
+			size_t size = st.st_size - off < MAP_WINDOW ? st.st_size - off : MAP_WINDOW;
+			char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, in, off);
+			if (map == MAP_FAILED) break;
+			madvise(map, size, MADV_SEQUENTIAL);
+			for (size_t pos = 0; pos < size; pos += CHUNK_SIZE) {
+				fn(map + pos, size - pos < CHUNK_SIZE ? size - pos : CHUNK_SIZE, arg);
+			}
+			munmap(map, size);
+		}
+		if (off >= st.st_size) {
+			if (in != STDIN_FILENO) close(in);
+			return st.st_size;
+		}
+		// mmap refused, read the rest
+		if (lseek(in, off, SEEK_SET) < 0) {
+			fprintf(stderr, "Error reading %s.\n", path);
+			exit(1);
+		}
+	}
+
+	// Pipes, terminals and anything mmap refused: read chunk by chunk
+	long long total = off;
+	ssize_t n;
+	while ((n = read(in, chunk, CHUNK_SIZE)) > 0) {
+		fn(chunk, n, arg);
+		total += n;
+	}
+	if (n < 0) {
+		fprintf(stderr, "Error reading %s.\n", path);
+		exit(1);
+	}
+	if (in != STDIN_FILENO) close(in);
+	return total;
+}
+
+// Where decode_chunk() decodes to
+typedef struct decode_out {
+	int fd;
+	int shifts;
+	char *chunk;
+} decode_out_t;
+
+/*
+ * scan_file() callback: decodes a piece of ciphertext into the chunk
+ * buffer, unless it's already there, and writes it out.
+ */
+void decode_chunk(const char *data, size_t len, void *arg) {
+
+	decode_out_t *d = arg;
+	if (data != d->chunk) memcpy(d->chunk, data, len);
+	decode_bytes(d->chunk, len, d->shifts);
+	write_all(d->fd, d->chunk, len);
+}
+
+/*
+ * Decodes the file at "path" ("-" for stdin) with "shifts" and writes the
+ * plaintext to "out", CHUNK_SIZE bytes at a time through "chunk".
+ * Returns the number of bytes decoded.
+ */
+long long decode_file(char *path, int out, int shifts, char *chunk) {
+
+	decode_out_t d = { out, shifts, chunk };
+	return scan_file(path, chunk, decode_chunk, &d);
+}
+
+// A file for the pipeline to decode
+typedef struct job {
+	char *in;
+	char *out;
+	int shifts;
+} job_t;
+
+// The files of a pipeline run, handed out to the threads in order
+typedef struct pipeline {
+	job_t *jobs;
+	int num_jobs;
+	int next;
+	long long bytes;
+	pthread_mutex_t lock;
+} pipeline_t;
+
+/*
+ * Adds a file to decode with "login" to the pipeline. The plaintext goes
+ * to "<in>.plain", or to a file of the same name in "out_dir" if given.
+ */
+void add_job(pipeline_t *pl, char *in, char *login, char *out_dir) {
+
+	if ((pl->num_jobs & (pl->num_jobs - 1)) == 0) {
+		int cap = pl->num_jobs ? pl->num_jobs * 2 : 16;
+		pl->jobs = realloc(pl->jobs, cap * sizeof(job_t));
+		if (pl->jobs == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	job_t *job = &pl->jobs[pl->num_jobs++];
+	job->in = strdup(in);
+	job->shifts = calculate_shifts(login);
+	if (out_dir != NULL) {
+		char *base = strrchr(in, '/') ? strrchr(in, '/') + 1 : in;
+		job->out = malloc(strlen(out_dir) + strlen(base) + 2);
+		if (job->out != NULL) sprintf(job->out, "%s/%s", out_dir, base);
+	} else {
+		job->out = malloc(strlen(in) + 7);
+		if (job->out != NULL) sprintf(job->out, "%s.plain", in);
+	}
+	if (job->in == NULL || job->out == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+}
+
+/*
+ * Reads the "file login" lines of a manifest into the pipeline. Blank lines
+ * and lines starting with # are skipped.
+ */
+void read_manifest(pipeline_t *pl, char *manifest, char *out_dir) {
+
+	FILE *fp = fopen(manifest, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open %s for reading.\n", manifest);
+		exit(1);
+	}
+
+	char line[4096];
+	char file[4096];
+	char login[256];
+	int line_num = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line_num++;
+		if (sscanf(line, " %c", file) != 1 || file[0] == '#') continue;
+		if (sscanf(line, "%4095s %255s", file, login) != 2) {
+			fprintf(stderr, "%s:%d: expected \"file login\".\n", manifest, line_num);
+			exit(1);
+		}
+		add_job(pl, file, login, out_dir);
+	}
+	fclose(fp);
+}
+
+/*
+ * Adds every regular file of "dir" to the pipeline, except earlier
+ * plaintexts (*.plain). The login is "login", or the file name up to its
+ * first '.'.
+ */
+void read_dir(pipeline_t *pl, char *dir, char *login, char *out_dir) {
+
+	DIR *dp = opendir(dir);
+	if (dp == NULL) {
+		fprintf(stderr, "Cannot open directory %s.\n", dir);
+		exit(1);
+	}
+
+	struct dirent *de;
+	while ((de = readdir(dp)) != NULL) {
+		size_t len = strlen(de->d_name);
+		if (de->d_name[0] == '.' || (len > 6 && strcmp(de->d_name + len - 6, ".plain") == 0)) continue;
+
+		char path[4096];
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
 
+		char name[256];
+		snprintf(name, sizeof(name), "%s", de->d_name);
+		name[strcspn(name, ".")] = '\0';
+		add_job(pl, path, login != NULL ? login : name, out_dir);
+	}
+	closedir(dp);
+}
+
+// Device and inode of a file, to tell when two paths are the same file
+typedef struct file_id {
+	dev_t dev;
+	ino_t ino;
+} file_id_t;
+
+/*
+ * qsort()/bsearch() comparator ordering file ids.
+ */
+int compare_ids(const void *a, const void *b) {
+
+	const file_id_t *x = a;
+	const file_id_t *y = b;
+	if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+	if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+	return 0;
+}
+
+/*
+ * qsort() comparator ordering strings.
+ */
+int compare_paths(const void *a, const void *b) {
+
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Returns "path" with its directory resolved by realpath(), so that two
+ * spellings of the same output file compare equal. The file itself need
+ * not exist yet. The caller frees the result.
+ */
+char *canonical_path(char *path) {
+
+	char *slash = strrchr(path, '/');
+	char *base = slash != NULL ? slash + 1 : path;
+	char *dir = slash == path ? strdup("/") : slash != NULL ? strndup(path, slash - path) : strdup(".");
+	char *real = dir != NULL ? realpath(dir, NULL) : NULL;
+	char *canon = real != NULL ? malloc(strlen(real) + strlen(base) + 2) : strdup(path);
+	if (canon == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	if (real != NULL) sprintf(canon, "%s/%s", real, base);
+	free(real);
+	free(dir);
+	return canon;
+}
+
+/*
+ * Refuses a pipeline that would truncate one of its own inputs, like
+ * "decode -d X -o X", or that would have two threads write the same
+ * output, like two inputs of the same name in different directories with
+ * -o.
+ */
+void check_jobs(pipeline_t *pl) {
+
+	if (pl->num_jobs == 0) return;
+	file_id_t *ids = malloc(pl->num_jobs * sizeof(file_id_t));
+	char **ins = malloc(pl->num_jobs * sizeof(char *));
+	char **outs = malloc(pl->num_jobs * sizeof(char *));
+	if (ids == NULL || ins == NULL || outs == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	struct stat st;
+	int num_ids = 0;
+	for (int i = 0; i < pl->num_jobs; i++) {
+		if (stat(pl->jobs[i].in, &st) == 0) {
+			ids[num_ids++] = (file_id_t) { st.st_dev, st.st_ino };
+		}
+		ins[i] = canonical_path(pl->jobs[i].in);
+	}
+	qsort(ids, num_ids, sizeof(file_id_t), compare_ids);
+	qsort(ins, pl->num_jobs, sizeof(char *), compare_paths);
+
+	for (int i = 0; i < pl->num_jobs; i++) {
+		job_t *job = &pl->jobs[i];
+		outs[i] = canonical_path(job->out);
+		int clash = bsearch(&outs[i], ins, pl->num_jobs, sizeof(char *), compare_paths) != NULL;
+		if (!clash && stat(job->out, &st) == 0) {
+			file_id_t id = { st.st_dev, st.st_ino };
+			clash = bsearch(&id, ids, num_ids, sizeof(file_id_t), compare_ids) != NULL;
+		}
+		if (clash) {
+			fprintf(stderr, "Output %s of %s is also an input file.\n", job->out, job->in);
+			exit(1);
+		}
+	}
+
+	qsort(outs, pl->num_jobs, sizeof(char *), compare_paths);
+	for (int i = 1; i < pl->num_jobs; i++) {
+		if (strcmp(outs[i - 1], outs[i]) == 0) {
+			fprintf(stderr, "More than one file would be decoded into %s.\n", outs[i]);
+			exit(1);
+		}
+	}
+
+	for (int i = 0; i < pl->num_jobs; i++) {
+		free(ins[i]);
+		free(outs[i]);
+	}
+	free(ins);
+	free(outs);
+	free(ids);
+}
+
+/*
+ * Pipeline thread: takes the next file until none are left and decodes it
+ * into its plaintext file.
+ */
+void *pipeline_worker(void *arg) {
+
+	pipeline_t *pl = arg;
+	char *chunk = malloc(CHUNK_SIZE);
+	if (chunk == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&pl->lock);
+		int i = pl->next++;
+		pthread_mutex_unlock(&pl->lock);
+		if (i >= pl->num_jobs) break;
+
+		job_t *job = &pl->jobs[i];
+		int out = open(job->out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0) {
+			fprintf(stderr, "Cannot open %s for writing.\n", job->out);
+			exit(1);
+		}
+		long long bytes = decode_file(job->in, out, job->shifts, chunk);
+		close(out);
+
+		pthread_mutex_lock(&pl->lock);
+		pl->bytes += bytes;
+		pthread_mutex_unlock(&pl->lock);
+	}
+
+	free(chunk);
+	return NULL;
+}
+
+/*
+ * Decodes the files of a manifest or a directory with "threads" threads and
+ * prints the throughput.
+ */
+void run_pipeline(char *manifest, char *dir, char *login, char *out_dir, int threads) {
+
+	pipeline_t pl = { NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+	if (manifest != NULL) read_manifest(&pl, manifest, out_dir);
+	else read_dir(&pl, dir, login, out_dir);
+	check_jobs(&pl);
+	if (threads > pl.num_jobs) threads = pl.num_jobs > 0 ? pl.num_jobs : 1;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_t *tids = malloc(threads * sizeof(pthread_t));
+	if (tids == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, pipeline_worker, &pl) != 0) {
+			fprintf(stderr, "Cannot start thread.\n");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (secs <= 0) secs = 1e-9;
+	printf("files:%d bytes:%lld threads:%d seconds:%.3f files/sec:%.1f MB/sec:%.1f\n",
+			pl.num_jobs, pl.bytes, threads, secs, pl.num_jobs / secs, pl.bytes / 1e6 / secs);
+
+	for (int i = 0; i < pl.num_jobs; i++) {
+		free(pl.jobs[i].in);
+		free(pl.jobs[i].out);
+	}
+	free(pl.jobs);
+	free(tids);
+}
+
+// Letter frequencies of English text in percent, a-z
+const double english_freq[26] = {
+	8.167, 1.492, 2.782, 4.253, 12.702, 2.228, 2.015, 6.094, 6.966, 0.153,
+	0.772, 4.025, 2.406, 6.749, 7.507, 1.929, 0.095, 5.987, 6.327, 9.056,
+	2.758, 0.978, 2.360, 0.150, 1.974, 0.074
+};
+
+/*
+ * Adds the lowercase letters of the "len" bytes at "data" to "letters",
+ * counting bytes into four tables in turn so that neighbouring bytes never
+ * wait on each other's increment of the same counter.
+ */
+void count_letters_scalar(const char *data, size_t len, unsigned long long letters[26]) {
+
+	unsigned int count[4][256];
+	const unsigned char *p = (const unsigned char *) data;
+	size_t i = 0;
+
+	memset(count, 0, sizeof(count));
+	for ( ; i + 4 <= len; i += 4) {
+		count[0][p[i]]++;
+		count[1][p[i + 1]]++;
+		count[2][p[i + 2]]++;
+		count[3][p[i + 3]]++;
+	}
+	for ( ; i < len; i++) count[0][p[i]]++;
+
+	for (int l = 0; l < 26; l++) {
+		letters[l] += (unsigned long long) count[0]['a' + l] + count[1]['a' + l]
+			+ count[2]['a' + l] + count[3]['a' + l];
+	}
+}
+
+#ifdef DECODE_X86
+/*
+ * The same as count_letters_scalar() with AVX2. Only 26 counters matter, so
+ * each 32 byte block is compared against every letter and the matches are
+ * counted in byte lanes, 13 letters per pass to stay in registers. The
+ * lanes are summed into "letters" every 255 blocks, before they can wrap.
+ */
+__attribute__((target("avx2")))
+void count_letters_avx2(const char *data, size_t len, unsigned long long letters[26]) {
+
+	size_t i = 0;
+
+	while (len - i >= 32) {
+		size_t stop = len - i < 255 * 32 ? i + (len - i) / 32 * 32 : i + 255 * 32;
+		for (int first = 0; first < 26; first += 13) {
+			const __m256i base = _mm256_set1_epi8('a' + first);
+			__m256i acc[13];
+			for (int l = 0; l < 13; l++) acc[l] = _mm256_setzero_si256();
+
+			for (size_t j = i; j < stop; j += 32) {
+				__m256i offset = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *) (data + j)), base);
+#pragma GCC unroll 13
+				for (int l = 0; l < 13; l++) {
+					acc[l] = _mm256_sub_epi8(acc[l], _mm256_cmpeq_epi8(offset, _mm256_set1_epi8(l)));
+				}
+			}
+
+			for (int l = 0; l < 13; l++) {
+				__m256i sums = _mm256_sad_epu8(acc[l], _mm256_setzero_si256());
+				letters[first + l] += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+					+ _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+			}
+		}
+		i = stop;
+	}
+	count_letters_scalar(data + i, len - i, letters);
+}
+#endif
+
+/*
+ * scan_file() callback: adds the lowercase letters of a piece of text to
+ * the 26 counts at "arg", with the widest version the CPU supports.
+ */
+void count_letters_chunk(const char *data, size_t len, void *arg) {
+
+	pthread_once(&impls_once, pick_impls);
+	count_impl(data, len, arg);
+}
+
+/*
+ * Counts the lowercase letters of the file at "path" ("-" for stdin) into
+ * "letters" in one pass. Returns the total number of letters.
+ */
+unsigned long long count_letters(char *path, char *chunk, unsigned long long letters[26]) {
+
+	unsigned long long total = 0;
+
+	memset(letters, 0, 26 * sizeof(letters[0]));
+	scan_file(path, chunk, count_letters_chunk, letters);
+	for (int l = 0; l < 26; l++) total += letters[l];
+	return total;
+}
+
+// A candidate shift and its chi-squared score, lower is more like English
+typedef struct shift_score {
+	int shifts;
+	double chi2;
+} shift_score_t;
+
+/*
+ * qsort comparator: ascending chi-squared score.
+ */
+int compare_scores(const void *a, const void *b) {
+
+	double x = ((const shift_score_t *) a)->chi2;
+	double y = ((const shift_score_t *) b)->chi2;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Ranks the 25 shifts for the ciphertext at "path" and prints the best
+ * "top". The letters are counted once; shifting by k just rotates the
+ * counts, so each shift is scored from the 26 counts instead of decoding
+ * the text again. The expected frequencies are English ones, or those of
+ * the plaintext file "corpus".
+ */
+void rank_shifts(char *path, char *corpus, int top) {
+
+	char *chunk = malloc(CHUNK_SIZE);
+	if (chunk == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	double expected[26];
+	if (corpus != NULL) {
+		unsigned long long counts[26];
+		unsigned long long total = count_letters(corpus, chunk, counts);
+		if (total == 0) {
+			fprintf(stderr, "No lowercase letters in %s.\n", corpus);
+			exit(1);
+		}
+		// add one to every letter so one the corpus lacks isn't impossible
+		for (int i = 0; i < 26; i++) expected[i] = (counts[i] + 1.0) / (total + 26.0);
+	} else {
+		for (int i = 0; i < 26; i++) expected[i] = english_freq[i] / 100;
+	}
+
+	unsigned long long letters[26];
+	unsigned long long total = count_letters(path, chunk, letters);
+	free(chunk);
+	if (total == 0) {
+		fprintf(stderr, "No lowercase letters to score.\n");
+		exit(1);
+	}
+
+	// decoding by k turns cipher letter i into plaintext letter (i + k) % 26
+	shift_score_t scores[25];
+	for (int k = 1; k <= 25; k++) {
+		double chi2 = 0;
+		for (int i = 0; i < 26; i++) {
+			double want = total * expected[(i + k) % 26];
+			double diff = letters[i] - want;
+			chi2 += diff * diff / want;
+		}
+		scores[k - 1].shifts = k;
+		scores[k - 1].chi2 = chi2;
+	}
+	qsort(scores, 25, sizeof(shift_score_t), compare_scores);
+
+	printf("letters:%llu\n", total);
+	for (int r = 0; r < top && r < 25; r++) {
+		printf("%2d. shifts:%2d chi2:%.2f\n", r + 1, scores[r].shifts, scores[r].chi2);
+	}
+}
+
+/*
+ * Prints how to run the program.
+ */
+void print_usage(char *argv[]) {
 
+	printf("Usage: %s [-h] [-k <login> [file|-]]\n", argv[0]);
+	printf("       %s [-h] (-m <manifest> | -d <dir> [-k <login>]) [-o <dir>] [-j <num>]\n", argv[0]);
+	printf("       %s [-h] -a [-c <corpus>] [-n <num>] [file|-]\n", argv[0]);
+	printf("  With no options, decodes the first line of cipher.txt with a login\n");
+	printf("  read from the terminal.\n");
+	printf("  -h          Print this help message.\n");
+	printf("  -k <login>  Decode all of the file (default: stdin) with this login\n");
+	printf("              and write the plaintext to stdout.\n");
+	printf("  -m <file>   Decode the files of a manifest of \"file login\" lines.\n");
+	printf("  -d <dir>    Decode the files of a directory with the -k login, or the\n");
+	printf("              login their name starts with (alice.txt for alice).\n");
+	printf("  -o <dir>    Write the plaintexts here instead of to <file>.plain.\n");
+	printf("  -j <num>    Threads for -m and -d (default: all cores).\n");
+	printf("  -a          Rank the 25 shifts by how English the file (default:\n");
+	printf("              stdin) looks after each, for an unknown login.\n");
+	printf("  -c <file>   Compare against the letters of this plaintext instead of\n");
+	printf("              English letter frequencies.\n");
+	printf("  -n <num>    Print only the best <num> shifts (default 25).\n");
+}
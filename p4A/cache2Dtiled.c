@@ -0,0 +1,284 @@
+/*
+ * cache2Dtiled.c:
+ * Faster ways to do the work of cache2Dcols.c, which fills
+ * arr2D[ROWS][COLS] column by column and so strides a whole row (2000
+ * bytes) between writes. Every variant writes arr2D[i][j] = i + j and is
+ * timed next to the naive row and column orders:
+ *  rows        the row-major loop of cache2Drows.c (the target)
+ *  cols        the column-major loop of cache2Dcols.c
+ *  tiled       column order within tiles small enough to stay in L1
+ *  transposed  column order into a column-major staging array, which is
+ *              sequential, then a tiled transpose into arr2D
+ * The tile sizes are tuned at startup by timing a few candidates derived
+ * from the host's L1 and L2 sizes.
+ *
+ * Build: gcc -O2 -o cache2Dtiled cache2Dtiled.c
+ */
+
+#include "cacheBench.h"
+
+int rows = 3000;
+int cols = 500;
+int tile_rows;  //rows of a tile for the tiled variant
+int tile_cols;  //columns of a tile for the tiled variant
+int block;      //square block of the transpose
+
+int *arr2D;     //rows x cols, row-major
+int *staging;   //cols x rows, the transposed variant's column-major copy
+
+/*
+ * fill_rows:
+ * cache2Drows.c.
+ */
+void fill_rows(void) {
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < cols; j++) {
+			arr2D[(size_t) i * cols + j] = i + j;
+		}
+	}
+}
+
+/*
+ * fill_cols:
+ * cache2Dcols.c.
+ */
+void fill_cols(void) {
+	for (int j = 0; j < cols; j++) {
+		for (int i = 0; i < rows; i++) {
+			arr2D[(size_t) i * cols + j] = i + j;
+		}
+	}
+}
+
+/*
+ * fill_tiled:
+ * Column order inside tile_rows x tile_cols tiles. A tile's row segments
+ * stay cached while its columns are walked, so each line is fetched once.
+ */
+void fill_tiled(void) {
+	for (int jj = 0; jj < cols; jj += tile_cols) {
+		int j_end = jj + tile_cols < cols ? jj + tile_cols : cols;
+		for (int ii = 0; ii < rows; ii += tile_rows) {
+			int i_end = ii + tile_rows < rows ? ii + tile_rows : rows;
+			for (int j = jj; j < j_end; j++) {
+				for (int i = ii; i < i_end; i++) {
+					arr2D[(size_t) i * cols + j] = i + j;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * fill_transposed:
+ * Column order into the column-major staging array, which makes it
+ * sequential, then a block by block transpose into arr2D.
+ */
+void fill_transposed(void) {
+	for (int j = 0; j < cols; j++) {
+		for (int i = 0; i < rows; i++) {
+			staging[(size_t) j * rows + i] = i + j;
+		}
+	}
+
+	for (int ii = 0; ii < rows; ii += block) {
+		int i_end = ii + block < rows ? ii + block : rows;
+		for (int jj = 0; jj < cols; jj += block) {
+			int j_end = jj + block < cols ? jj + block : cols;
+			for (int i = ii; i < i_end; i++) {
+				for (int j = jj; j < j_end; j++) {
+					arr2D[(size_t) i * cols + j] = staging[(size_t) j * rows + i];
+				}
+			}
+		}
+	}
+}
+
+/*
+ * time_fill:
+ * Returns the best time in ns of "fill" over "reps" runs, after a warm-up.
+ */
+double time_fill(void (*fill)(void), int reps) {
+	double best = 0;
+
+	fill();
+	for (int r = 0; r < reps; r++) {
+		double start = now_ns();
+		fill();
+		double ns = now_ns() - start;
+		if (r == 0 || ns < best) best = ns;
+	}
+	return best;
+}
+
+/*
+ * checksum:
+ * Runs "fill" once over arrays set to -1, which no variant writes, and
+ * returns a checksum of arr2D so the variants can be checked against each
+ * other. Starting from the sentinel, a cell a variant skips still holds -1
+ * and changes the sum, instead of holding what the previous variant wrote.
+ */
+unsigned long long checksum(void (*fill)(void)) {
+	unsigned long long sum = 0;
+
+	memset(arr2D, 0xff, (size_t) rows * cols * sizeof(int));
+	memset(staging, 0xff, (size_t) rows * cols * sizeof(int));
+	fill();
+	for (size_t k = 0; k < (size_t) rows * cols; k++) {
+		sum = sum * 31 + arr2D[k];
+	}
+	return sum;
+}
+
+/*
+ * tune:
+ * Picks the tile and transpose block sizes. Tile candidates are one to
+ * four lines wide, with enough rows for their row segments to fill half
+ * of L1 or half of L2; transpose blocks are squares from one line up to
+ * two blocks in half of L1. The fastest candidate on the real array wins.
+ */
+void tune(int reps) {
+	long l1 = cache_size(1) > 0 ? cache_size(1) : 32 << 10;
+	long l2 = cache_size(2) > 0 ? cache_size(2) : 256 << 10;
+	long budgets[] = { l1 / 2, l2 / 2 };
+	int line_ints = LINE_SIZE / sizeof(int);
+	int best_rows = 1, best_cols = line_ints, best_block = line_ints;
+	double best = 0;
+
+	for (int width = line_ints; width <= 4 * line_ints; width *= 2) {
+		for (int k = 0; k < 2; k++) {
+			tile_cols = width;
+			tile_rows = budgets[k] / (width * sizeof(int));
+			if (tile_rows < 1) tile_rows = 1;
+			double ns = time_fill(fill_tiled, reps);
+			if (best == 0 || ns < best) {
+				best = ns;
+				best_rows = tile_rows;
+				best_cols = tile_cols;
+			}
+		}
+	}
+	tile_rows = best_rows;
+	tile_cols = best_cols;
+
+	best = 0;
+	for (int size = line_ints; size * size * 2 * (long) sizeof(int) <= l1 / 2; size *= 2) {
+		block = size;
+		double ns = time_fill(fill_transposed, reps);
+		if (best == 0 || ns < best) {
+			best = ns;
+			best_block = size;
+		}
+	}
+	block = best_block;
+}
+
+/*
+ * print_usage:
+ * Prints information on how to use the benchmark.
+ */
+void print_usage(char *argv[]) {
+	printf("Usage: %s [-h] [-R <rows>] [-C <cols>] [-r <num>] [-T <rows:cols>] [-B <num>]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -R <rows>  Rows of the array (default 3000).\n");
+	printf("  -C <cols>  Columns of the array (default 500).\n");
+	printf("  -r <num>   Repetitions, the fastest one counts (default 5).\n");
+	printf("  -T <r:c>   Use this tile instead of tuning one.\n");
+	printf("  -B <num>   Use this transpose block instead of tuning one.\n");
+}
+
+int main(int argc, char *argv[]) {
+	int reps = 5;
+	int c;
+
+	while ((c = getopt(argc, argv, "R:C:r:T:B:h")) != -1) {
+		switch (c) {
+			case 'R':
+				rows = atoi(optarg);
+				break;
+			case 'C':
+				cols = atoi(optarg);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'T':
+				if (sscanf(optarg, "%d:%d", &tile_rows, &tile_cols) != 2) {
+					print_usage(argv);
+					exit(1);
+				}
+				break;
+			case 'B':
+				block = atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv);
+				exit(0);
+			default:
+				print_usage(argv);
+				exit(1);
+		}
+	}
+	if (rows < 1 || cols < 1 || reps < 1 || tile_rows < 0 || tile_cols < 0 || block < 0) {
+		print_usage(argv);
+		exit(1);
+	}
+
+	size_t size = (size_t) rows * cols * sizeof(int);
+	arr2D = bench_alloc(size);
+	staging = bench_alloc(size);
+	memset(arr2D, 0, size);
+	memset(staging, 0, size);
+
+	// tune whatever wasn't given on the command line
+	int fixed_tile = tile_rows > 0 && tile_cols > 0, fixed_block = block > 0;
+	if (!fixed_tile || !fixed_block) {
+		int keep_rows = tile_rows, keep_cols = tile_cols, keep_block = block;
+		tune(1);
+		if (fixed_tile) {
+			tile_rows = keep_rows;
+			tile_cols = keep_cols;
+		}
+		if (fixed_block) {
+			block = keep_block;
+		}
+	}
+
+	struct {
+		const char *name;
+		void (*fill)(void);
+	} variants[] = {
+		{ "rows", fill_rows },
+		{ "cols", fill_cols },
+		{ "tiled", fill_tiled },
+		{ "transposed", fill_transposed },
+	};
+
+	char buf[24];
+	print_caches();
+	printf("# array %dx%d (%s) tile %dx%d transpose block %d\n", rows, cols,
+			format_size(size, buf, sizeof(buf)), tile_rows, tile_cols, block);
+	printf("%-11s %12s %12s %16s\n", "variant", "ms", "ns/element", "speedup vs cols");
+
+	double ns[4];
+	unsigned long long expected = 0;
+	for (int k = 0; k < 4; k++) {
+		ns[k] = time_fill(variants[k].fill, reps);
+		unsigned long long sum = checksum(variants[k].fill);
+		if (k == 0) {
+			expected = sum;
+		} else if (sum != expected) {
+			printf("Error: %s wrote a different array\n", variants[k].name);
+			exit(1);
+		}
+	}
+	for (int k = 0; k < 4; k++) {
+		printf("%-11s %12.3f %12.3f %16.2f\n", variants[k].name, ns[k] / 1e6,
+				ns[k] / ((double) rows * cols), ns[1] / ns[k]);
+	}
+
+	free(arr2D);
+	free(staging);
+	return 0;
+}
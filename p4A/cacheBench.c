@@ -0,0 +1,368 @@
+/*
+ * cacheBench.c:
+ * Times the access patterns of the cache1D, cache2Drows, cache2Dcols and
+ * cache2Dclash programs, plus strided and random pointer chasing ones,
+ * over array sizes doubling from well inside L1 to well beyond the last
+ * level cache. Each pattern is warmed up once, then repeated and the
+ * fastest repetition is reported as ns/access and GB/s, which traces the
+ * memory hierarchy of the host.
+ *
+ * With -e, hardware counters (cachePerf.h) are read over one more
+ * repetition and reported per access. No csim prediction is made here;
+ * the host's L1d is printed as csim's -s/-E/-b so that l1d_misses can be
+ * compared by hand with a csim run of the same pattern (cacheTrace.c
+ * traces the seq, rows, cols and clash ones). -c prints CSV instead of a
+ * table.
+ *
+ * Build: gcc -O2 -o cacheBench cacheBench.c
+ */
+
+#include "cacheBench.h"
+#include "cachePerf.h"
+
+//Columns of the 2D patterns: 500 ints, a 2000 byte row like cache2Dcols.c.
+#define COLS 500
+
+//Every repetition makes at least this many accesses.
+#define MIN_ACCESSES (1 << 22)
+
+int stride = LINE_SIZE / sizeof(int); //ints between strided accesses
+int clash = 4096 / sizeof(int);       //ints between conflicting accesses
+
+volatile long sink; //keeps results alive
+
+//Type pattern_t: One access pattern over an array of "n" ints. "run"
+//makes one pass and returns how many accesses it made; "prepare", if set,
+//runs once before timing.
+typedef struct pattern {
+	const char *name;
+	void (*prepare)(int *arr, size_t n);
+	size_t (*run)(int *arr, size_t n);
+	int bytes; //bytes read or written per access
+} pattern_t;
+
+/*
+ * run_seq:
+ * cache1D.c: writes the array front to back.
+ */
+size_t run_seq(int *arr, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		arr[i] = i;
+	}
+	return n;
+}
+
+/*
+ * run_rows:
+ * cache2Drows.c: fills a ROWS x COLS array row by row.
+ */
+size_t run_rows(int *arr, size_t n) {
+	size_t cols = n < COLS ? n : COLS;
+	size_t rows = n / cols;
+	int (*arr2D)[cols] = (int (*)[cols]) arr;
+
+	for (size_t i = 0; i < rows; i++) {
+		for (size_t j = 0; j < cols; j++) {
+			arr2D[i][j] = i + j;
+		}
+	}
+	return rows * cols;
+}
+
+/*
+ * run_cols:
+ * cache2Dcols.c: fills the same array column by column.
+ */
+size_t run_cols(int *arr, size_t n) {
+	size_t cols = n < COLS ? n : COLS;
+	size_t rows = n / cols;
+	int (*arr2D)[cols] = (int (*)[cols]) arr;
+
+	for (size_t j = 0; j < cols; j++) {
+		for (size_t i = 0; i < rows; i++) {
+			arr2D[i][j] = i + j;
+		}
+	}
+	return rows * cols;
+}
+
+/*
+ * run_stride:
+ * Writes one int every "stride" ints, by default one per cache line.
+ */
+size_t run_stride(int *arr, size_t n) {
+	size_t count = 0;
+	for (size_t i = 0; i < n; i += stride) {
+		arr[i] = i;
+		count++;
+	}
+	return count;
+}
+
+/*
+ * run_clash:
+ * Like cache2Dclash.c but at scale: writes the whole array in passes
+ * "clash" ints apart, so each pass lands in a single cache set.
+ */
+size_t run_clash(int *arr, size_t n) {
+	for (size_t off = 0; off < (size_t) clash && off < n; off++) {
+		for (size_t i = off; i < n; i += clash) {
+			arr[i] = i;
+		}
+	}
+	return n;
+}
+
+/*
+ * prepare_chase:
+ * Links the cache lines of the array into one random cycle (Sattolo's
+ * algorithm), so every load depends on the previous one and hardware
+ * prefetchers can't guess the next line.
+ */
+void prepare_chase(int *arr, size_t n) {
+	size_t nodes = n * sizeof(int) / LINE_SIZE;
+	size_t *order = malloc(nodes * sizeof(size_t));
+	unsigned long long x = 88172645463325252ULL;
+	char *base = (char *) arr;
+
+	if (order == NULL) {
+		printf("Error: malloc failed\n");
+		exit(1);
+	}
+	for (size_t i = 0; i < nodes; i++) {
+		order[i] = i;
+	}
+	for (size_t i = nodes - 1; i > 0; i--) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		size_t j = x % i;
+		size_t t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	for (size_t i = 0; i < nodes; i++) {
+		*(void **) (base + order[i] * LINE_SIZE) = base + order[(i + 1) % nodes] * LINE_SIZE;
+	}
+	free(order);
+}
+
+/*
+ * run_chase:
+ * Follows the cycle built by prepare_chase() once around.
+ */
+size_t run_chase(int *arr, size_t n) {
+	size_t nodes = n * sizeof(int) / LINE_SIZE;
+	void **p = (void **) arr;
+
+	for (size_t i = 0; i < nodes; i++) {
+		p = *p;
+	}
+	sink = (long) p;
+	return nodes;
+}
+
+pattern_t patterns[] = {
+	{ "seq", NULL, run_seq, sizeof(int) },
+	{ "rows", NULL, run_rows, sizeof(int) },
+	{ "cols", NULL, run_cols, sizeof(int) },
+	{ "stride", NULL, run_stride, sizeof(int) },
+	{ "clash", NULL, run_clash, sizeof(int) },
+	{ "chase", prepare_chase, run_chase, sizeof(void *) },
+};
+
+#define NUM_PATTERNS (int) (sizeof(patterns) / sizeof(patterns[0]))
+
+/*
+ * measure:
+ * Returns the best ns/access of a pattern on an array of "size" bytes
+ * over "reps" repetitions, after one warm-up pass. If "pc" has open
+ * counters, stores their counts per access in "rates" (-1 if unavailable).
+ */
+double measure(pattern_t *p, size_t size, int reps, perf_counters_t *pc, double *rates) {
+	size_t n = size / sizeof(int);
+	int *arr = bench_alloc(size);
+	double best = 0;
+
+	memset(arr, 0, size);
+	if (p->prepare != NULL) {
+		p->prepare(arr, n);
+	}
+	size_t per_pass = p->run(arr, n);
+	size_t passes = (MIN_ACCESSES + per_pass - 1) / per_pass;
+
+	for (int r = 0; r < reps; r++) {
+		double start = now_ns();
+		for (size_t i = 0; i < passes; i++) {
+			p->run(arr, n);
+		}
+		double ns = (now_ns() - start) / (passes * per_pass);
+		if (r == 0 || ns < best) best = ns;
+	}
+
+	if (pc != NULL && pc->available > 0) {
+		perf_start(pc);
+		for (size_t i = 0; i < passes; i++) {
+			p->run(arr, n);
+		}
+		perf_stop(pc);
+		for (int i = 0; i < PERF_EVENTS; i++) {
+			rates[i] = pc->value[i] < 0 ? -1 : (double) pc->value[i] / (passes * per_pass);
+		}
+	}
+
+	sink = arr[n / 2];
+	free(arr);
+	return best;
+}
+
+/*
+ * level_of:
+ * Returns the smallest cache level that holds "size" bytes.
+ */
+const char *level_of(size_t size) {
+	const char *names[] = { "L1", "L2", "L3" };
+	for (int level = 1; level <= 3; level++) {
+		long cache = cache_size(level);
+		if (cache > 0 && size <= (size_t) cache) {
+			return names[level - 1];
+		}
+	}
+	return "mem";
+}
+
+/*
+ * print_l1_geometry:
+ * Prints the host's L1d as csim's -s, -E and -b, or nothing if the
+ * geometry is unknown or not a power of two.
+ */
+void print_l1_geometry(void) {
+	long size = cache_size(1), ways = 0, line = 0;
+	int s = 0, b = 0;
+
+#ifdef _SC_LEVEL1_DCACHE_ASSOC
+	ways = sysconf(_SC_LEVEL1_DCACHE_ASSOC);
+	line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+	if (size <= 0 || ways <= 0 || line <= 0 || size % (ways * line) != 0) {
+		return;
+	}
+	long sets = size / (ways * line);
+	while ((1L << s) < sets) s++;
+	while ((1L << b) < line) b++;
+	if ((1L << s) == sets && (1L << b) == line) {
+		printf("# L1d as csim: -s %d -E %ld -b %d\n", s, ways, b);
+	}
+}
+
+/*
+ * print_usage:
+ * Prints information on how to use the benchmark.
+ */
+void print_usage(char *argv[]) {
+	printf("Usage: %s [-hec] [-p <list>] [-n <size>] [-m <size>] [-r <num>] [-k <num>]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -e         Add hardware counters per access (perf_event_open).\n");
+	printf("  -c         Print CSV instead of a table.\n");
+	printf("  -p <list>  Patterns (default all): seq, rows, cols, stride, clash, chase.\n");
+	printf("  -n <size>  Smallest array, with an optional K, M or G (default 4K).\n");
+	printf("  -m <size>  Largest array (default 256M).\n");
+	printf("  -r <num>   Repetitions, the fastest one counts (default 5).\n");
+	printf("  -k <num>   Stride of the stride pattern in ints (default 16).\n");
+}
+
+int main(int argc, char *argv[]) {
+	size_t min_size = 4 << 10;
+	size_t max_size = 256 << 20;
+	char *list = NULL;
+	int reps = 5;
+	int counters = 0;
+	int csv = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "p:n:m:r:k:ech")) != -1) {
+		switch (c) {
+			case 'e':
+				counters = 1;
+				break;
+			case 'c':
+				csv = 1;
+				break;
+			case 'p':
+				list = optarg;
+				break;
+			case 'n':
+				min_size = parse_size(optarg);
+				break;
+			case 'm':
+				max_size = parse_size(optarg);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'k':
+				stride = atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv);
+				exit(0);
+			default:
+				print_usage(argv);
+				exit(1);
+		}
+	}
+	if (min_size < LINE_SIZE || max_size < min_size || reps < 1 || stride < 1) {
+		print_usage(argv);
+		exit(1);
+	}
+
+	perf_counters_t pc;
+	if (counters && perf_open(&pc) == 0) {
+		fprintf(stderr, "Hardware counters are unavailable (see "
+				"/proc/sys/kernel/perf_event_paranoid), timing only\n");
+	}
+
+	if (csv) {
+		printf("pattern,size,fits,ns_per_access,gb_per_s");
+	} else {
+		print_caches();
+		if (counters) print_l1_geometry();
+		printf("%-8s %8s %5s %12s %10s", "pattern", "size", "fits", "ns/access", "GB/s");
+	}
+	for (int k = 0; counters && k < PERF_EVENTS; k++) {
+		printf(csv ? ",%s" : " %12s", perf_name(k));
+	}
+	printf("\n");
+
+	for (int i = 0; i < NUM_PATTERNS; i++) {
+		pattern_t *p = &patterns[i];
+		if (list != NULL && strstr(list, p->name) == NULL) {
+			continue;
+		}
+		for (size_t size = min_size; size <= max_size; size *= 2) {
+			char buf[24];
+			double rates[PERF_EVENTS];
+			double ns = measure(p, size, reps, counters ? &pc : NULL, rates);
+			if (csv) {
+				printf("%s,%zu,%s,%.4f,%.4f", p->name, size, level_of(size), ns, p->bytes / ns);
+			} else {
+				printf("%-8s %8s %5s %12.3f %10.3f", p->name, format_size(size, buf, sizeof(buf)),
+						level_of(size), ns, p->bytes / ns);
+			}
+			for (int k = 0; counters && k < PERF_EVENTS; k++) {
+				if (pc.available == 0 || rates[k] < 0) {
+					printf(csv ? "," : " %12s", "n/a");
+				} else {
+					printf(csv ? ",%.5f" : " %12.5f", rates[k]);
+				}
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+	if (counters) {
+		perf_close(&pc);
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * cacheBench.h:
+ * Timing, allocation and cache size helpers shared by the p4A benchmark
+ * programs. Everything is static so each program stays a single file to
+ * build: gcc -O2 -o cacheBench cacheBench.c
+ */
+
+#ifndef CACHE_BENCH_H
+#define CACHE_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//Bytes in a cache line, used when a program can't ask the system.
+#define LINE_SIZE 64
+
+/*
+ * now_ns:
+ * Returns a monotonic time in nanoseconds.
+ */
+static inline double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * bench_alloc:
+ * Allocates "size" bytes aligned to a cache line, or exits.
+ */
+static inline void *bench_alloc(size_t size) {
+	void *p = NULL;
+	if (posix_memalign(&p, LINE_SIZE, size) != 0) {
+		printf("Error: malloc failed\n");
+		exit(1);
+	}
+	return p;
+}
+
+/*
+ * parse_size:
+ * Parses a byte count with an optional K, M or G suffix.
+ */
+static inline size_t parse_size(const char *arg) {
+	char *end;
+	size_t size = strtoull(arg, &end, 10);
+
+	switch (*end) {
+		case 'g': case 'G': size <<= 10; // fall through
+		case 'm': case 'M': size <<= 10; // fall through
+		case 'k': case 'K': size <<= 10;
+	}
+	return size;
+}
+
+/*
+ * format_size:
+ * Writes "size" to "buf" as a short human readable byte count.
+ */
+static inline const char *format_size(size_t size, char *buf, size_t len) {
+	if (size >= 1 << 30 && size % (1 << 30) == 0) {
+		snprintf(buf, len, "%zuG", size >> 30);
+	} else if (size >= 1 << 20 && size % (1 << 20) == 0) {
+		snprintf(buf, len, "%zuM", size >> 20);
+	} else if (size >= 1 << 10 && size % (1 << 10) == 0) {
+		snprintf(buf, len, "%zuK", size >> 10);
+	} else {
+		snprintf(buf, len, "%zu", size);
+	}
+	return buf;
+}
+
+/*
+ * cache_size:
+ * Returns the size in bytes of the level 1 (data), 2 or 3 cache, or 0 if
+ * it's unknown. Asks sysconf first, then sysfs.
+ */
+static inline long cache_size(int level) {
+	long size = 0;
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+	if (level == 1) size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	if (level == 2) size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (level == 3) size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+	if (size > 0) {
+		return size;
+	}
+
+	// sysfs lists instruction caches too; take the data or unified one
+	for (int index = 0; index < 8; index++) {
+		char path[96], type[32] = "";
+		int found_level = 0;
+		FILE *fp;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+		if ((fp = fopen(path, "r")) == NULL) break;
+		if (fscanf(fp, "%d", &found_level) != 1) found_level = 0;
+		fclose(fp);
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+		if ((fp = fopen(path, "r")) != NULL) {
+			if (fscanf(fp, "%31s", type) != 1) type[0] = '\0';
+			fclose(fp);
+		}
+		if (found_level != level || strcmp(type, "Instruction") == 0) continue;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+		if ((fp = fopen(path, "r")) != NULL) {
+			char text[32];
+			if (fscanf(fp, "%31s", text) == 1) size = parse_size(text);
+			fclose(fp);
+		}
+		return size > 0 ? size : 0;
+	}
+	return 0;
+}
+
+/*
+ * print_caches:
+ * Prints the host's cache sizes as a comment line.
+ */
+static inline void print_caches(void) {
+	char buf[3][24];
+	printf("# L1d:%s L2:%s L3:%s\n",
+			cache_size(1) ? format_size(cache_size(1), buf[0], 24) : "?",
+			cache_size(2) ? format_size(cache_size(2), buf[1], 24) : "?",
+			cache_size(3) ? format_size(cache_size(3), buf[2], 24) : "?");
+}
+
+#endif
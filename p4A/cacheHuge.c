@@ -0,0 +1,359 @@
+/*
+ * cacheHuge.c:
+ * The p4A arrays are static globals, so their pages, and with them the
+ * TLB behavior, are whatever the loader gives .bss. This benchmark
+ * allocates the 2D array of cache2Drows.c / cache2Dcols.c at hundreds of
+ * MB in several ways and times the row, column and clash traversals on
+ * each:
+ *  malloc          the C library's choice
+ *  mmap            anonymous mmap, faulted in 4K pages on first touch
+ *  mmap+populate   the same, faulted in up front (MADV_POPULATE_WRITE
+ *                  where the kernel has it, else one touch per page)
+ *  huge            mmap aligned to 2M with MADV_HUGEPAGE (transparent
+ *                  huge pages)
+ *  huge+populate   the same, faulted in right after madvise
+ * The first three are the 4K baselines: they are marked MADV_NOHUGEPAGE
+ * so that transparent_hugepage=always can't turn them into huge pages,
+ * and a warning is printed if one still reports huge MB. The column and
+ * clash walks touch a new page on nearly every access, so their gap
+ * between 4K and huge pages is mostly TLB misses. With -e the dTLB misses
+ * per access are read from the hardware counters.
+ *
+ * Build: gcc -O2 -o cacheHuge cacheHuge.c
+ */
+
+#include <sys/mman.h>
+
+#include "cacheBench.h"
+#include "cachePerf.h"
+
+//Columns of the array: 500 ints, a 2000 byte row like cache2Dcols.c.
+#define COLS 500
+
+//Huge page size assumed for alignment.
+#define HUGE_SIZE (2 << 20)
+
+volatile long sink; //keeps results alive
+
+//Type array_t: An allocated array and how to release it.
+typedef struct array {
+	int *data;
+	void *map;       //mapping to munmap, NULL if from malloc
+	size_t map_size;
+} array_t;
+
+//Type variant_t: One way to allocate the array.
+typedef struct variant {
+	const char *name;
+	int use_mmap;
+	int populate;
+	int huge;
+} variant_t;
+
+variant_t variants[] = {
+	{ "malloc", 0, 0, 0 },
+	{ "mmap", 1, 0, 0 },
+	{ "mmap+populate", 1, 1, 0 },
+	{ "huge", 1, 0, 1 },
+	{ "huge+populate", 1, 1, 1 },
+};
+
+#define NUM_VARIANTS (int) (sizeof(variants) / sizeof(variants[0]))
+
+/*
+ * no_huge_pages:
+ * Marks the whole pages inside "size" bytes at "p" MADV_NOHUGEPAGE.
+ */
+void no_huge_pages(void *p, size_t size) {
+#ifdef MADV_NOHUGEPAGE
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = ((unsigned long) p + page - 1) & ~(page - 1);
+	unsigned long end = ((unsigned long) p + size) & ~(page - 1);
+	if (end > start) {
+		madvise((void *) start, end - start, MADV_NOHUGEPAGE);
+	}
+#else
+	(void) p;
+	(void) size;
+#endif
+}
+
+/*
+ * populate:
+ * Faults in the "size" bytes at "p" before they are first used.
+ */
+void populate(void *p, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(p, size, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+	for (size_t off = 0; off < size; off += 4096) {
+		((volatile char *) p)[off] = 0;
+	}
+}
+
+/*
+ * alloc_array:
+ * Allocates "size" bytes as described by "v". Only the huge variants may
+ * get transparent huge pages.
+ */
+array_t alloc_array(variant_t *v, size_t size) {
+	array_t a = { NULL, NULL, 0 };
+
+	if (!v->use_mmap) {
+		a.data = malloc(size);
+		if (a.data == NULL) {
+			printf("Error: malloc failed\n");
+			exit(1);
+		}
+		no_huge_pages(a.data, size);
+		return a;
+	}
+
+	// huge pages need 2M alignment, so map a little extra and round up
+	a.map_size = size + (v->huge ? HUGE_SIZE : 0);
+	a.map = mmap(NULL, a.map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (a.map == MAP_FAILED) {
+		printf("Error: mmap failed\n");
+		exit(1);
+	}
+	a.data = a.map;
+	if (v->huge) {
+		a.data = (int *) (((unsigned long) a.map + HUGE_SIZE - 1) & ~(unsigned long) (HUGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+		madvise(a.data, size, MADV_HUGEPAGE);
+#endif
+	} else {
+		no_huge_pages(a.map, a.map_size);
+	}
+
+	// MAP_POPULATE would fault in pages before madvise, so populate after it
+	if (v->populate) {
+		populate(a.data, size);
+	}
+	return a;
+}
+
+/*
+ * free_array:
+ * Releases an array from alloc_array().
+ */
+void free_array(array_t *a) {
+	if (a->map != NULL) {
+		munmap(a->map, a->map_size);
+	} else {
+		free(a->data);
+	}
+}
+
+/*
+ * huge_bytes:
+ * Returns how much of this process's memory is in transparent huge
+ * pages, or -1 if the kernel doesn't say.
+ */
+long long huge_bytes(void) {
+	FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+	char line[128];
+	long long kb = -1;
+
+	if (fp == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "AnonHugePages: %lld kB", &kb) == 1) {
+			break;
+		}
+	}
+	fclose(fp);
+	return kb < 0 ? -1 : kb << 10;
+}
+
+/*
+ * walk_rows:
+ * cache2Drows.c over "rows" rows.
+ */
+void walk_rows(int *arr, size_t rows) {
+	int (*arr2D)[COLS] = (int (*)[COLS]) arr;
+	for (size_t i = 0; i < rows; i++) {
+		for (size_t j = 0; j < COLS; j++) {
+			arr2D[i][j] = i + j;
+		}
+	}
+}
+
+/*
+ * walk_cols:
+ * cache2Dcols.c over "rows" rows.
+ */
+void walk_cols(int *arr, size_t rows) {
+	int (*arr2D)[COLS] = (int (*)[COLS]) arr;
+	for (size_t j = 0; j < COLS; j++) {
+		for (size_t i = 0; i < rows; i++) {
+			arr2D[i][j] = i + j;
+		}
+	}
+}
+
+/*
+ * walk_clash:
+ * Passes over the whole array 4096 bytes apart, one per page offset, so
+ * consecutive writes share a cache set and each lands on another page.
+ */
+void walk_clash(int *arr, size_t rows) {
+	size_t n = rows * COLS;
+	size_t step = 4096 / sizeof(int);
+	for (size_t off = 0; off < step; off++) {
+		for (size_t i = off; i < n; i += step) {
+			arr[i] = i;
+		}
+	}
+}
+
+struct {
+	const char *name;
+	void (*walk)(int *arr, size_t rows);
+} walks[] = {
+	{ "rows", walk_rows },
+	{ "cols", walk_cols },
+	{ "clash", walk_clash },
+};
+
+#define NUM_WALKS 3
+
+/*
+ * print_usage:
+ * Prints information on how to use the benchmark.
+ */
+void print_usage(char *argv[]) {
+	printf("Usage: %s [-he] [-m <size>[,<size>...]] [-r <num>]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -e         Add dTLB misses per access (perf_event_open).\n");
+	printf("  -m <list>  Array sizes, with an optional K, M or G (default 256M).\n");
+	printf("  -r <num>   Repetitions, the fastest one counts (default 3).\n");
+}
+
+int main(int argc, char *argv[]) {
+	char *sizes = "256M";
+	int reps = 3;
+	int counters = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:r:eh")) != -1) {
+		switch (c) {
+			case 'm':
+				sizes = optarg;
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'e':
+				counters = 1;
+				break;
+			case 'h':
+				print_usage(argv);
+				exit(0);
+			default:
+				print_usage(argv);
+				exit(1);
+		}
+	}
+	if (reps < 1) {
+		print_usage(argv);
+		exit(1);
+	}
+
+	perf_counters_t pc;
+	if (counters && perf_open(&pc) == 0) {
+		fprintf(stderr, "Hardware counters are unavailable (see "
+				"/proc/sys/kernel/perf_event_paranoid), timing only\n");
+	}
+
+	char thp[128] = "?";
+	FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (fp != NULL) {
+		if (fgets(thp, sizeof(thp), fp) == NULL) strcpy(thp, "?");
+		thp[strcspn(thp, "\n")] = '\0';
+		fclose(fp);
+	}
+	print_caches();
+	printf("# transparent_hugepage: %s\n", thp);
+	printf("%-14s %6s %10s %10s", "variant", "size", "touch ms", "huge MB");
+	for (int w = 0; w < NUM_WALKS; w++) {
+		printf(" %10s", walks[w].name);
+		if (counters) printf(" %10s", "dtlb/acc");
+	}
+	printf("   (ns/access)\n");
+
+	char *copy = strdup(sizes);
+	char *save = NULL;
+	for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		size_t rows = parse_size(item) / (COLS * sizeof(int));
+		size_t size = rows * COLS * sizeof(int);
+		if (rows == 0) {
+			print_usage(argv);
+			exit(1);
+		}
+
+		for (int v = 0; v < NUM_VARIANTS; v++) {
+			long long huge_before = huge_bytes();
+
+			// allocation plus first touch of every page
+			double start = now_ns();
+			array_t a = alloc_array(&variants[v], size);
+			memset(a.data, 0, size);
+			double touch = now_ns() - start;
+			long long huge = huge_bytes();
+
+			printf("%-14s %6s %10.1f", variants[v].name, item, touch / 1e6);
+			if (huge < 0 || huge_before < 0) {
+				printf(" %10s", "?");
+			} else {
+				printf(" %10lld", (huge - huge_before) >> 20);
+				if (!variants[v].huge && huge > huge_before) {
+					fprintf(stderr, "Warning: %s got %lld MB of huge pages, so it is not a 4K "
+							"baseline\n", variants[v].name, (huge - huge_before) >> 20);
+				}
+			}
+
+			for (int w = 0; w < NUM_WALKS; w++) {
+				double best = 0;
+				for (int r = 0; r < reps; r++) {
+					double t = now_ns();
+					walks[w].walk(a.data, rows);
+					t = now_ns() - t;
+					if (r == 0 || t < best) best = t;
+				}
+				printf(" %10.3f", best / (rows * COLS));
+
+				if (counters) {
+					double dtlb = -1;
+					if (pc.available > 0) {
+						perf_start(&pc);
+						walks[w].walk(a.data, rows);
+						perf_stop(&pc);
+						if (pc.value[PERF_DTLB_MISSES] >= 0) {
+							dtlb = (double) pc.value[PERF_DTLB_MISSES] / (rows * COLS);
+						}
+					}
+					if (dtlb < 0) {
+						printf(" %10s", "n/a");
+					} else {
+						printf(" %10.5f", dtlb);
+					}
+				}
+			}
+			printf("\n");
+			fflush(stdout);
+
+			sink = a.data[size / sizeof(int) / 2];
+			free_array(&a);
+		}
+	}
+	free(copy);
+	if (counters) {
+		perf_close(&pc);
+	}
+	return 0;
+}
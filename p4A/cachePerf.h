@@ -0,0 +1,184 @@
+/*
+ * cachePerf.h:
+ * Hardware performance counters for the p4A benchmarks through
+ * perf_event_open (Linux only). Each counter is opened on its own, so a
+ * counter the CPU, the kernel or a container doesn't provide is just
+ * reported as unavailable instead of failing the run. When there are more
+ * counters than the PMU has, the kernel multiplexes them, so each count is
+ * scaled by the time its counter was enabled over the time it was running.
+ */
+
+#ifndef CACHE_PERF_H
+#define CACHE_PERF_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+//Counters read around each kernel.
+#define PERF_CYCLES       0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES   2
+#define PERF_LLC_MISSES   3
+#define PERF_DTLB_MISSES  4
+#define PERF_EVENTS       5
+
+/*
+ * perf_name:
+ * Returns the report name of counter "i".
+ */
+static inline const char *perf_name(int i) {
+	static const char *names[PERF_EVENTS] = {
+		"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses"
+	};
+	return names[i];
+}
+
+//Type perf_counters_t: Open counters; fd is -1 for unavailable ones.
+//Store misses are added to l1d_misses where the CPU counts them, since the
+//p4A kernels mostly write.
+typedef struct perf_counters {
+	int fd[PERF_EVENTS];
+	int l1d_write_fd;
+	long long value[PERF_EVENTS];
+	int available; //number of counters that opened
+} perf_counters_t;
+
+#ifdef __linux__
+/*
+ * perf_open_one:
+ * Opens one user space counter of this thread, disabled, or returns -1.
+ */
+static inline int perf_open_one(unsigned int type, unsigned long long config) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * perf_read:
+ * Disables a counter and returns its count scaled up to the time it was
+ * enabled, or -1 if it can't be read or never got onto the PMU.
+ */
+static inline long long perf_read(int fd) {
+	unsigned long long data[3]; //count, time enabled, time running
+
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+		return -1;
+	}
+	if (data[2] < data[1]) {
+		return (long long) ((double) data[0] * data[1] / data[2]);
+	}
+	return data[0];
+}
+
+//Config of a read miss event in a PERF_TYPE_HW_CACHE cache.
+#define PERF_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+/*
+ * perf_open:
+ * Opens every counter the system allows. Returns how many opened.
+ */
+static inline int perf_open(perf_counters_t *pc) {
+	memset(pc, 0, sizeof(*pc));
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		pc->fd[i] = -1;
+	}
+	pc->l1d_write_fd = -1;
+
+#ifdef __linux__
+	pc->fd[PERF_CYCLES] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	pc->fd[PERF_INSTRUCTIONS] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	pc->fd[PERF_L1D_MISSES] = perf_open_one(PERF_TYPE_HW_CACHE, PERF_READ_MISS(PERF_COUNT_HW_CACHE_L1D));
+	pc->fd[PERF_LLC_MISSES] = perf_open_one(PERF_TYPE_HW_CACHE, PERF_READ_MISS(PERF_COUNT_HW_CACHE_LL));
+	if (pc->fd[PERF_LLC_MISSES] < 0) {
+		pc->fd[PERF_LLC_MISSES] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	}
+	pc->l1d_write_fd = perf_open_one(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+			| (PERF_COUNT_HW_CACHE_OP_WRITE << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	pc->fd[PERF_DTLB_MISSES] = perf_open_one(PERF_TYPE_HW_CACHE, PERF_READ_MISS(PERF_COUNT_HW_CACHE_DTLB));
+#endif
+
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		if (pc->fd[i] >= 0) pc->available++;
+	}
+	return pc->available;
+}
+
+/*
+ * perf_start:
+ * Zeroes and enables the open counters.
+ */
+static inline void perf_start(perf_counters_t *pc) {
+#ifdef __linux__
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		if (pc->fd[i] >= 0) {
+			ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	if (pc->l1d_write_fd >= 0) {
+		ioctl(pc->l1d_write_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(pc->l1d_write_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void) pc;
+#endif
+}
+
+/*
+ * perf_stop:
+ * Disables the open counters and reads them into "value"; unavailable
+ * ones read as -1.
+ */
+static inline void perf_stop(perf_counters_t *pc) {
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		pc->value[i] = -1;
+#ifdef __linux__
+		if (pc->fd[i] >= 0) {
+			pc->value[i] = perf_read(pc->fd[i]);
+		}
+#endif
+	}
+#ifdef __linux__
+	if (pc->l1d_write_fd >= 0) {
+		long long writes = perf_read(pc->l1d_write_fd);
+		if (writes >= 0 && pc->value[PERF_L1D_MISSES] >= 0) {
+			pc->value[PERF_L1D_MISSES] += writes;
+		}
+	}
+#endif
+}
+
+/*
+ * perf_close:
+ * Closes the open counters.
+ */
+static inline void perf_close(perf_counters_t *pc) {
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		if (pc->fd[i] >= 0) close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+	if (pc->l1d_write_fd >= 0) close(pc->l1d_write_fd);
+	pc->l1d_write_fd = -1;
+	pc->available = 0;
+}
+
+#endif
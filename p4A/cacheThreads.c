@@ -0,0 +1,323 @@
+/*
+ * cacheThreads.c:
+ * Multithreaded versions of the p4A fill kernels. The 1D fill of
+ * cache1D.c, the row-major fill of cache2Drows.c and the column-major fill
+ * of cache2Dcols.c are split over 1, 2, 4, ... threads, with the elements
+ * (1D), rows or columns handed out in one of three ways:
+ *  contiguous  one block per thread
+ *  element     round robin by element, so neighbours in memory belong to
+ *              different threads and cache lines are shared (false sharing)
+ *  line        round robin by whole cache lines, so each line has one
+ *              owner: 16 ints (1D), 16 rows, which are 500 lines (rows),
+ *              or 16 int runs cut at every row's own line boundaries,
+ *              since a 2000 byte row starts 0, 16, 32 or 48 bytes into a
+ *              line, each walked down the rows like a column (cols)
+ * A second test increments one counter per thread, packed next to each
+ * other or padded to a cache line each, which isolates the false sharing
+ * penalty.
+ *
+ * Build: gcc -O2 -pthread -o cacheThreads cacheThreads.c
+ */
+
+#include <pthread.h>
+
+#include "cacheBench.h"
+
+#define MAX_THREADS 64
+
+//Columns of the 2D kernels: 500 ints, a 2000 byte row like cache2Dcols.c.
+#define COLS 500
+
+//Elements per "line" partition, one cache line of ints.
+#define GROUP (LINE_SIZE / (int) sizeof(int))
+
+#define KERNEL_1D   0
+#define KERNEL_ROWS 1
+#define KERNEL_COLS 2
+
+#define SPLIT_CONTIGUOUS 0
+#define SPLIT_ELEMENT    1
+#define SPLIT_LINE       2
+
+const char *kernel_names[] = { "1D", "rows", "cols" };
+const char *split_names[] = { "contiguous", "element", "line" };
+
+size_t n = 16 << 20; //ints in the 1D array
+size_t rows = 12000; //rows of the 2D array
+int *arr;            //shared by the 1D and 2D kernels
+
+//Type job_t: What one worker thread does.
+typedef struct job {
+	int id;
+	int threads;
+	int kernel;
+	int split;
+	long iters;           //counter test only
+	volatile long *count; //counter test only
+	pthread_t thread;
+} job_t;
+
+//Type range_t: The indices a thread owns: runs of "run" indices that
+//start at "start", "start + stride", ... below "end".
+typedef struct range {
+	size_t start;
+	size_t end;
+	size_t stride;
+	size_t run;
+} range_t;
+
+/*
+ * owned:
+ * Returns the indices of a dimension of length "len" that a job owns.
+ */
+range_t owned(job_t *job, size_t len) {
+	range_t r;
+
+	if (job->split == SPLIT_CONTIGUOUS) {
+		r.start = len * job->id / job->threads;
+		r.end = len * (job->id + 1) / job->threads;
+		r.run = r.end - r.start;
+		r.stride = r.run ? r.run : 1;
+	} else if (job->split == SPLIT_ELEMENT) {
+		r.start = job->id;
+		r.end = len;
+		r.run = 1;
+		r.stride = job->threads;
+	} else {
+		r.start = (size_t) job->id * GROUP;
+		r.end = len;
+		r.run = GROUP;
+		r.stride = (size_t) job->threads * GROUP;
+	}
+	return r;
+}
+
+/*
+ * fill_cols_lines:
+ * The column-major fill for the line split. A row starts "off" ints into a
+ * line, so group g of row i, columns g * GROUP - off up to g * GROUP +
+ * GROUP - off, is one cache line, and each of its GROUP ints is walked
+ * down the rows like a column. Groups from 1 on go round robin; group 0 of
+ * a row that doesn't start a line holds the rest of the last line of the
+ * row above, so it goes to that line's owner.
+ */
+void fill_cols_lines(job_t *job) {
+	int (*arr2D)[COLS] = (int (*)[COLS]) arr;
+	size_t id = job->id;
+	size_t threads = job->threads;
+
+	for (size_t c = 0; c < GROUP; c++) {
+		for (size_t i = 0; i < rows; i++) {
+			size_t off = i * COLS % GROUP;
+			size_t owner = off ? (COLS - 1 + (i - 1) * COLS % GROUP) / GROUP % threads : 0; //of group 0
+			if (owner == id && c >= off) {
+				arr2D[i][c - off] = i + c - off;
+			}
+		}
+	}
+	for (size_t g = id ? id : threads; g <= COLS / GROUP + 1; g += threads) {
+		for (size_t c = 0; c < GROUP; c++) {
+			for (size_t i = 0; i < rows; i++) {
+				size_t j = g * GROUP + c - i * COLS % GROUP; //past COLS in the row's last lines
+				if (j < COLS) {
+					arr2D[i][j] = i + j;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * fill_run:
+ * Worker: fills its part of the array with the job's kernel.
+ */
+void *fill_run(void *arg) {
+	job_t *job = arg;
+	if (job->kernel == KERNEL_COLS && job->split == SPLIT_LINE) {
+		fill_cols_lines(job);
+		return NULL;
+	}
+
+	int (*arr2D)[COLS] = (int (*)[COLS]) arr;
+	range_t r = owned(job, job->kernel == KERNEL_1D ? n : job->kernel == KERNEL_ROWS ? rows : COLS);
+
+	for (size_t g = r.start; g < r.end; g += r.stride) {
+		size_t stop = g + r.run < r.end ? g + r.run : r.end;
+		for (size_t k = g; k < stop; k++) {
+			if (job->kernel == KERNEL_1D) {
+				arr[k] = k;
+			} else if (job->kernel == KERNEL_ROWS) {
+				for (size_t j = 0; j < COLS; j++) {
+					arr2D[k][j] = k + j;
+				}
+			} else {
+				for (size_t i = 0; i < rows; i++) {
+					arr2D[i][k] = i + k;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * count_run:
+ * Worker: increments its counter "iters" times.
+ */
+void *count_run(void *arg) {
+	job_t *job = arg;
+	for (long i = 0; i < job->iters; i++) {
+		(*job->count)++;
+	}
+	return NULL;
+}
+
+/*
+ * run_jobs:
+ * Runs "threads" workers of "fn" over "jobs" and returns the wall time in
+ * ns from the first start to the last join.
+ */
+double run_jobs(void *(*fn)(void *), job_t *jobs, int threads) {
+	double start = now_ns();
+	for (int t = 0; t < threads; t++) {
+		if (pthread_create(&jobs[t].thread, NULL, fn, &jobs[t]) != 0) {
+			fprintf(stderr, "Error: pthread_create failed\n");
+			exit(1);
+		}
+	}
+	for (int t = 0; t < threads; t++) {
+		pthread_join(jobs[t].thread, NULL);
+	}
+	return now_ns() - start;
+}
+
+/*
+ * time_fill:
+ * Returns the best time in ns of a kernel split over "threads" threads.
+ */
+double time_fill(int kernel, int split, int threads, int reps) {
+	job_t jobs[MAX_THREADS];
+	double best = 0;
+
+	for (int t = 0; t < threads; t++) {
+		jobs[t] = (job_t) { .id = t, .threads = threads, .kernel = kernel, .split = split };
+	}
+	for (int r = 0; r < reps; r++) {
+		double ns = run_jobs(fill_run, jobs, threads);
+		if (r == 0 || ns < best) best = ns;
+	}
+	return best;
+}
+
+//Type padded_t: A counter alone in its cache line.
+typedef struct padded {
+	volatile long count;
+	char pad[LINE_SIZE - sizeof(long)];
+} padded_t;
+
+/*
+ * time_counters:
+ * Returns the best time in ns for "threads" threads to each bump their
+ * own counter "iters" times, with the counters packed or padded.
+ */
+double time_counters(int threads, int padded, long iters, int reps) {
+	static volatile long packed[MAX_THREADS] __attribute__((aligned(LINE_SIZE)));
+	static padded_t spread[MAX_THREADS] __attribute__((aligned(LINE_SIZE)));
+	job_t jobs[MAX_THREADS];
+	double best = 0;
+
+	for (int t = 0; t < threads; t++) {
+		jobs[t] = (job_t) { .id = t, .threads = threads, .iters = iters,
+				.count = padded ? &spread[t].count : &packed[t] };
+	}
+	for (int r = 0; r < reps; r++) {
+		double ns = run_jobs(count_run, jobs, threads);
+		if (r == 0 || ns < best) best = ns;
+	}
+	return best;
+}
+
+/*
+ * print_usage:
+ * Prints information on how to use the benchmark.
+ */
+void print_usage(char *argv[]) {
+	printf("Usage: %s [-h] [-T <num>] [-n <num>] [-R <rows>] [-i <num>] [-r <num>]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -T <num>   Most threads; counts double from 1 (default: all cores).\n");
+	printf("  -n <num>   Ints in the 1D array (default 16M).\n");
+	printf("  -R <rows>  Rows of the 2D array, 500 ints each (default 12000).\n");
+	printf("  -i <num>   Increments per thread in the counter test (default 50M).\n");
+	printf("  -r <num>   Repetitions, the fastest one counts (default 3).\n");
+}
+
+int main(int argc, char *argv[]) {
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long iters = 50000000;
+	int reps = 3;
+	int c;
+
+	while ((c = getopt(argc, argv, "T:n:R:i:r:h")) != -1) {
+		switch (c) {
+			case 'T':
+				max_threads = atoi(optarg);
+				break;
+			case 'n':
+				n = parse_size(optarg);
+				break;
+			case 'R':
+				rows = atol(optarg);
+				break;
+			case 'i':
+				iters = atol(optarg);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv);
+				exit(0);
+			default:
+				print_usage(argv);
+				exit(1);
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS || n < 1 || rows < 1
+			|| iters < 1 || reps < 1) {
+		print_usage(argv);
+		exit(1);
+	}
+
+	size_t ints = n > rows * COLS ? n : rows * COLS;
+	arr = bench_alloc(ints * sizeof(int));
+	memset(arr, 0, ints * sizeof(int));
+
+	print_caches();
+	printf("# cores:%ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-7s %-11s %7s %10s %8s %8s\n", "kernel", "split", "threads", "ms", "GB/s", "speedup");
+	for (int kernel = KERNEL_1D; kernel <= KERNEL_COLS; kernel++) {
+		size_t elems = kernel == KERNEL_1D ? n : rows * COLS;
+		for (int split = SPLIT_CONTIGUOUS; split <= SPLIT_LINE; split++) {
+			double single = 0;
+			for (int threads = 1; threads <= max_threads; threads *= 2) {
+				double ns = time_fill(kernel, split, threads, reps);
+				if (threads == 1) single = ns;
+				printf("%-7s %-11s %7d %10.3f %8.3f %8.2f\n", kernel_names[kernel], split_names[split],
+						threads, ns / 1e6, elems * sizeof(int) / ns, single / ns);
+				fflush(stdout);
+			}
+		}
+	}
+
+	printf("\n%-7s %12s %12s %8s\n", "threads", "packed ms", "padded ms", "penalty");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		double packed = time_counters(threads, 0, iters, reps);
+		double padded = time_counters(threads, 1, iters, reps);
+		printf("%-7d %12.3f %12.3f %8.2f\n", threads, packed / 1e6, padded / 1e6, packed / padded);
+		fflush(stdout);
+	}
+
+	free(arr);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * cacheTrace.c:
+ * Runs the loops of cache1D.c, cache2Drows.c, cache2Dcols.c and
+ * cache2Dclash.c with every array store reported to csim, instead of
+ * tracing the programs with Valgrind lackey. The arrays are declared like
+ * in the original programs, so the addresses, and with them the sets they
+ * map to, are real ones.
+ *
+ * By default the stores go straight into csim's access_data_rw() in this
+ * process, which simulates the 1.5M stores of cache2Dcols.c in tens of
+ * milliseconds, and the usual hits/misses/evictions summary (and
+ * .csim_results) is printed. With -T the stores are printed in Valgrind's
+ * trace format instead, to be replayed with csim -t or piped into
+ * csim -t -.
+ *
+ * Only the array stores are reported. Lackey also records the loop
+ * counters, which an unoptimized build keeps on the stack, so its counts
+ * are higher by those (nearly always hitting) accesses.
+ *
+ * Build: gcc -O2 -pthread -o cacheTrace cacheTrace.c -lm
+ */
+
+#define CSIM_NO_MAIN
+#include "../p4B/csim.c"
+
+#include <time.h>
+
+//cache1D.c
+#define GLOBAL_N 100000
+
+//cache2Drows.c and cache2Dcols.c
+#define ROWS 3000
+#define COLS 500
+
+//cache2Dclash.c
+#define CLASH_ROWS 128
+#define CLASH_COLS 8
+#define CLASH_REPS 100
+
+int arr[GLOBAL_N];
+int arr2D[ROWS][COLS];
+int clash2D[CLASH_ROWS][CLASH_COLS];
+
+FILE *trace_out = NULL; //with -T, where the stores are printed
+long long stores = 0;
+
+/*
+ * now_ms:
+ * Returns a monotonic time in milliseconds.
+ */
+double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * store:
+ * Reports a 4 byte store at "p" to csim, or prints it with -T.
+ */
+static inline void store(void *p) {
+	mem_addr_t addr = (mem_addr_t) p;
+
+	stores++;
+	if (trace_out != NULL) {
+		fprintf(trace_out, " S %llx,%zu\n", addr, sizeof(int));
+		return;
+	}
+	if (verbosity)
+		printf("S %llx,%zu ", addr, sizeof(int));
+	access_data_rw(addr, 1, sizeof(int));
+	if (verbosity)
+		printf("\n");
+}
+
+/*
+ * kernel_1D:
+ * cache1D.c.
+ */
+void kernel_1D(void) {
+	for (int i = 0; i < GLOBAL_N; i++) {
+		store(&arr[i]);
+	}
+}
+
+/*
+ * kernel_rows:
+ * cache2Drows.c.
+ */
+void kernel_rows(void) {
+	for (int i = 0; i < ROWS; i++) {
+		for (int j = 0; j < COLS; j++) {
+			store(&arr2D[i][j]);
+		}
+	}
+}
+
+/*
+ * kernel_cols:
+ * cache2Dcols.c.
+ */
+void kernel_cols(void) {
+	for (int j = 0; j < COLS; j++) {
+		for (int i = 0; i < ROWS; i++) {
+			store(&arr2D[i][j]);
+		}
+	}
+}
+
+/*
+ * kernel_clash:
+ * cache2Dclash.c.
+ */
+void kernel_clash(void) {
+	for (int k = 0; k < CLASH_REPS; k++) {
+		for (int i = 0; i < CLASH_ROWS; i++) {
+			for (int j = 0; j < CLASH_COLS; j++) {
+				store(&clash2D[i][j]);
+			}
+		}
+	}
+}
+
+struct {
+	const char *name;
+	void (*run)(void);
+} kernels[] = {
+	{ "1D", kernel_1D },
+	{ "rows", kernel_rows },
+	{ "cols", kernel_cols },
+	{ "clash", kernel_clash },
+};
+
+#define NUM_KERNELS (int) (sizeof(kernels) / sizeof(kernels[0]))
+
+/*
+ * print_trace_usage:
+ * Prints information on how to use the tracer.
+ */
+void print_trace_usage(char* argv[]) {
+	printf("Usage: %s [-hvT] -k <kernel> [-s <num> -E <num> -b <num>] [-r <policy>]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -v         Optional verbose flag.\n");
+	printf("  -T         Print the stores as a Valgrind trace instead of simulating.\n");
+	printf("  -k <name>  Kernel: 1D, rows, cols or clash.\n");
+	printf("  -s <num>   Number of set index bits.\n");
+	printf("  -E <num>   Number of lines per set.\n");
+	printf("  -b <num>   Number of block offset bits.\n");
+	printf("  -r <name>  Replacement policy, as in csim (default lru).\n");
+	printf("\nExamples:\n");
+	printf("  linux>  %s -k cols -s 5 -E 1 -b 5\n", argv[0]);
+	printf("  linux>  %s -T -k rows | ../p4B/csim -s 5 -E 1 -b 5 -t -\n", argv[0]);
+}
+
+int main(int argc, char* argv[]) {
+	char *name = NULL;
+	int emit = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "k:s:E:b:r:Tvh")) != -1) {
+		switch (c) {
+			case 'k':
+				name = optarg;
+				break;
+			case 's':
+				s = atoi(optarg);
+				break;
+			case 'E':
+				E = atoi(optarg);
+				break;
+			case 'b':
+				b = atoi(optarg);
+				break;
+			case 'r':
+				parse_policy(optarg);
+				break;
+			case 'T':
+				emit = 1;
+				break;
+			case 'v':
+				verbosity = 1;
+				break;
+			case 'h':
+				print_trace_usage(argv);
+				exit(0);
+			default:
+				print_trace_usage(argv);
+				exit(1);
+		}
+	}
+
+	int k = 0;
+	while (name != NULL && k < NUM_KERNELS && strcmp(name, kernels[k].name) != 0) {
+		k++;
+	}
+	if (name == NULL || k == NUM_KERNELS) {
+		printf("%s: Missing or unknown kernel\n", argv[0]);
+		print_trace_usage(argv);
+		exit(1);
+	}
+
+	if (emit) {
+		trace_out = stdout;
+		kernels[k].run();
+		return 0;
+	}
+
+	if (s == 0 || E == 0 || b == 0) {
+		printf("%s: Missing required command line argument\n", argv[0]);
+		print_trace_usage(argv);
+		exit(1);
+	}
+	init_cache();
+	double start = now_ms();
+	kernels[k].run();
+	double ms = now_ms() - start;
+	free_cache();
+
+	//Also writes .csim_results, like a csim run.
+	print_summary(hit_cnt, miss_cnt, evict_cnt);
+	fprintf(stderr, "%s: %lld stores simulated in %.1f ms\n", kernels[k].name, stores, ms);
+	return 0;
+}
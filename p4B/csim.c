@@ -2,14 +2,34 @@
  * csim.c:
  * A cache simulator that can replay traces (from Valgrind) and output
  * statistics for the number of hits, misses, and evictions.
- * The replacement policy is LRU.
+ * The replacement policy is LRU unless another one is chosen with -r.
  *
  * Implementation and assumptions:
  *  1. Each load/store can cause at most one cache miss plus a possible eviction.
+ *  With -l, an access that straddles blocks is counted once per block instead.
  *  2. Instruction loads (I) are ignored.
  *  3. Data modify (M) is treated as a load followed by a store to the same
  *  address. Hence, an M operation can result in two cache hits, or a miss and a
  *  hit plus a possible eviction.
+ *
+ * Sweep mode (-c) decodes the trace once and replays it against a whole list
+ * of cache configurations, one worker thread per group of configurations.
+ * Stack distance mode (-d) computes the fully associative LRU miss ratio
+ * curve for every capacity in a single pass.
+ * With -j, a normal run partitions the sets across worker threads.
+ * Hierarchy mode (-H) simulates several write-back levels in front of memory.
+ * Coherence mode (-M) merges per-core traces and keeps private caches
+ * coherent with MESI, counting invalidations and false sharing.
+ * Checkpoints (-o, -i) save a warmed-up cache and resume from it later.
+ * Sampled runs (-S, -W) simulate only some sets and/or some windows of the
+ * trace and estimate the totals with confidence intervals.
+ * Prefetchers (-P) can be attached to the cache or to each level; the hit,
+ * miss and eviction summary only counts demand accesses.
+ *
+ * Traces are read by a background thread in large chunks, so a trace can be
+ * streamed from a pipe (-t -) straight out of Valgrind without a file.
+ *
+ * Build: gcc -O2 -pthread -o csim csim.c -lm
  */
 
 #include <getopt.h>
@@ -22,6 +42,10 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 /******************************************************************************/
 /* DO NOT MODIFY THESE VARIABLES **********************************************/
@@ -40,244 +64,3736 @@ int hit_cnt = 0;
 int miss_cnt = 0;
 int evict_cnt = 0;
 
-//Global to control trace output
-int verbosity = 0; //print trace if set
+//Global to control trace output
+int verbosity = 0; //print trace if set
+/******************************************************************************/
+
+
+//Type mem_addr_t: Use when dealing with addresses or address masks.
+typedef unsigned long long int mem_addr_t;
+
+//MESI states of a private cache line in coherence mode (-M).
+#define MESI_I 0
+#define MESI_S 1
+#define MESI_E 2
+#define MESI_M 3
+
+//Type cache_line_t: Use when dealing with cache lines.
+//TODO - COMPLETE THIS TYPE
+typedef struct cache_line {
+        char valid;
+        char dirty; //set once the line is written, until it's written back
+        char prefetched; //filled by a prefetch and not used by a demand access yet
+        char mesi; //coherence mode only: MESI state of a valid line
+        mem_addr_t tag;
+        //Add a data member as needed by your implementation for LRU tracking.
+        //Replacement state, its meaning depends on the policy: last use stamp
+        //(LRU), fill stamp (FIFO), use count (LFU) or RRPV (SRRIP/BRRIP).
+        unsigned long long counter;
+} cache_line_t;
+
+//Type cache_set_t: Use when dealing with cache sets
+//Note: Each set is a pointer to a heap array of one or more cache lines.
+typedef cache_line_t* cache_set_t;
+
+//Type cache_t: Use when dealing with the cache.
+//Note: A cache is a pointer to a heap array of one or more sets.
+typedef cache_set_t* cache_t;
+
+// Create the cache we're simulating.
+//Note: A cache is a pointer to a heap array of one or more cache sets.
+cache_t cache;
+
+//Replacement policies, selected with -r.
+#define POLICY_LRU     0
+#define POLICY_FIFO    1
+#define POLICY_RANDOM  2
+#define POLICY_PLRU    3 //tree pseudo-LRU, E a power of 2 up to 64
+#define POLICY_BITPLRU 4 //MRU-bit pseudo-LRU, E up to 64
+#define POLICY_SRRIP   5
+#define POLICY_BRRIP   6
+#define POLICY_LFU     7
+
+const char *policy_names[] = {
+	"lru", "fifo", "random", "plru", "bitplru", "srrip", "brrip", "lfu"
+};
+
+//RRIP parameters: 2-bit re-reference prediction values, and BRRIP's
+//1-in-BRRIP_EPSILON chance of inserting with a long instead of distant RRPV.
+#define RRPV_MAX 3
+#define BRRIP_EPSILON 32
+
+//Replacement policy and seed for all caches, set by -r.
+int policy = POLICY_LRU;
+unsigned long long policy_seed = 1;
+
+//Write policy for all caches, set by -w. Hierarchies are always
+//write-back/write-allocate.
+int write_through = 0;
+int write_allocate = 1;
+int write_stats = 0; //print the write counters after the summary
+
+//Split accesses that cover several blocks into one access per block, set by -l.
+int split_blocks = 0;
+
+//Prefetch models, selected per cache level with -P.
+#define PREFETCH_NONE   0
+#define PREFETCH_NEXT   1 //next-N-line, tagged
+#define PREFETCH_STRIDE 2 //per instruction stride, reference prediction table
+#define PREFETCH_STREAM 3 //stream buffer style sequential stream detection
+
+const char *prefetch_names[] = { "none", "next", "stride", "stream" };
+
+#define RPT_SIZE 64            //reference prediction table entries
+#define STREAMS 8              //streams tracked by the stream model
+#define POLLUTION_FILTER 1024  //remembered victims of prefetch fills
+#define MAX_PREFETCH_DEGREE 16
+
+//Type rpt_entry_t: Stride history of one load/store instruction.
+typedef struct rpt_entry {
+	mem_addr_t pc;
+	mem_addr_t last;  //address of its previous access
+	long long stride;
+	int state;        //0 new, 1 stride seen once, 2 steady
+} rpt_entry_t;
+
+//Type stream_t: One sequential stream followed by the stream model.
+typedef struct stream {
+	mem_addr_t last;   //block of the last access in the stream
+	mem_addr_t ahead;  //furthest block prefetched
+	int dir;           //+1 ascending, -1 descending, 0 not known yet
+	unsigned long long used; //for replacing the least recently used stream
+} stream_t;
+
+//Type prefetcher_t: A prefetch model attached to one cache and its
+//counters. A prefetch is useful if a demand access hits the line before it
+//is evicted, and pollution counts demand misses on blocks that a prefetch
+//fill evicted.
+typedef struct prefetcher {
+	int kind;
+	int degree;
+	rpt_entry_t rpt[RPT_SIZE];
+	stream_t streams[STREAMS];
+	unsigned long long stamp;
+	mem_addr_t victims[POLLUTION_FILTER]; //block + 1 of victims, 0 if empty
+	long long issued;
+	long long useful;
+	long long uncovered; //demand misses no prefetch saved
+	long long pollution;
+} prefetcher_t;
+
+//Type cache_sim_t: One simulated cache with its own geometry and counters.
+//The single cache driven by access_data() is one of these, and sweep mode
+//keeps one per configuration.
+typedef struct cache_sim {
+	int s, E, b;            //geometry as given on the command line
+	int S, B;               //derived: S = 2^s sets, B = 2^b bytes per block
+	cache_t sets;
+	int policy;
+	//One word of replacement state per set: the tree bits (PLRU), the MRU
+	//bits (bit-PLRU) or the random number generator (random, BRRIP). Keeping
+	//the generator per set makes results independent of how sets are split
+	//across threads.
+	unsigned long long *set_state;
+	unsigned long long stamp; //incremented on every access, used for LRU
+	long long hits;
+	long long misses;
+	long long evictions;
+	long long writebacks; //dirty lines written to the next level or memory
+	char write_through;   //stores go to memory instead of dirtying lines
+	char write_allocate;  //store misses fill the cache
+	long long mem_read_bytes;  //single level only: bytes fetched from memory
+	long long mem_write_bytes; //single level only: bytes written to memory
+	prefetcher_t *pf;          //NULL without prefetching
+	char prefetch_hit;         //set when a demand hit uses a prefetched line
+} cache_sim_t;
+
+//Results of cache_access().
+#define ACCESS_HIT   0
+#define ACCESS_MISS  1
+#define ACCESS_EVICT 2 //a miss that also evicted a valid line
+
+// The cache behind access_data(), built from the global s, E and b.
+cache_sim_t sim;
+
+//Type trace_access_t: One decoded data access from a trace file.
+typedef struct trace_access {
+	mem_addr_t addr;
+	mem_addr_t pc; //instruction from the preceding I line, 0 if none
+	unsigned int len;
+	char op; //'L', 'S' or 'M'
+	unsigned char core; //coherence mode: core whose trace it's from
+	char cont; //with -l: set on every piece of a split access but the first
+} trace_access_t;
+
+//Size of each of the two chunks a trace is read in, and longest trace line.
+#define TRACE_CHUNK (4 << 20)
+#define TRACE_LINE 1000
+
+//Type trace_reader_t: A trace being read by a background thread.
+//The thread fills one chunk while the parser works through the other, so
+//reading a pipe overlaps with simulation and never buffers more than two
+//chunks ahead of the parser.
+typedef struct trace_reader {
+	char *name;
+	int fd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *chunks[2];
+	size_t chunk_len[2];
+	int chunk_full[2];    //chunk holds data the parser hasn't finished
+	int eof;              //the reader thread reached the end of input
+	int stop;             //trace_close() wants the reader thread to quit
+	int cur;              //chunk being parsed, -1 if none
+	int next;             //chunk to parse after it
+	char *data;           //parse position: data[pos..len)
+	size_t len;
+	size_t pos;
+	char carry[TRACE_LINE]; //start of a line split across chunks
+	size_t carry_len;
+	mem_addr_t pc;        //address of the last I line
+} trace_reader_t;
+
+/*
+ * policy_check:
+ * Returns NULL if "policy" can manage sets of E lines, else the reason why not.
+ */
+const char *policy_check(int policy, int E) {
+	if (policy == POLICY_PLRU && (E > 64 || (E & (E - 1)) != 0)) {
+		return "plru needs E to be a power of 2 no larger than 64";
+	}
+	if (policy == POLICY_BITPLRU && E > 64) {
+		return "bitplru needs E no larger than 64";
+	}
+	return NULL;
+}
+
+/*
+ * cache_init:
+ * Allocates the sets of a cache with 2^s sets, E lines per set and 2^b byte
+ * blocks, using the global replacement policy. All lines start invalid with
+ * zeroed tags and counters.
+ */
+void cache_init(cache_sim_t *c, int s, int E, int b) {
+	memset(c, 0, sizeof(*c));
+	c->s = s;
+	c->E = E;
+	c->b = b;
+	c->S = 1 << s;
+	c->B = 1 << b;
+	c->policy = policy;
+	c->write_through = write_through;
+	c->write_allocate = write_allocate;
+
+	const char *why = policy_check(policy, E);
+	if (why != NULL) {
+		fprintf(stderr, "Error: %s\n", why);
+		exit(1);
+	}
+
+	// allocate memory for cache with S sets
+	c->sets = (cache_set_t*) malloc(sizeof(cache_set_t) * c->S);
+	c->set_state = (unsigned long long*) calloc(c->S, sizeof(unsigned long long));
+	if (c->sets == NULL || c->set_state == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	// allocate memory for E lines per set, all valid bits and tags 0s
+	for (int i = 0; i < c->S; i++) {
+		c->sets[i] = (cache_line_t*) calloc(E, sizeof(cache_line_t));
+		if (c->sets[i] == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+
+		// seed each set's generator differently; xorshift state can't be 0
+		if (policy == POLICY_RANDOM || policy == POLICY_BRRIP) {
+			c->set_state[i] = (policy_seed + 1) * 0x9e3779b97f4a7c15ULL ^ (i + 1);
+		}
+	}
+}
+
+/*
+ * cache_free:
+ * Frees all heap allocated memory used by one cache.
+ */
+void cache_free(cache_sim_t *c) {
+	// free memory used by the sets
+	for (int i = 0; i < c->S; i++) {
+		free(c->sets[i]);
+	}
+
+	// free memory used by cache
+	free(c->sets);
+	free(c->set_state);
+	c->sets = NULL;
+	c->set_state = NULL;
+}
+
+/*
+ * set_random:
+ * Returns the next number from a set's xorshift64* generator.
+ */
+static inline unsigned long long set_random(unsigned long long *state) {
+	unsigned long long x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * plru_touch:
+ * Points the tree bits on the path to "way" away from it. Node n has
+ * children 2n and 2n+1, the root is node 1 and bit n set means the victim
+ * is in the right subtree.
+ */
+static inline void plru_touch(unsigned long long *bits, int E, int way) {
+	int node = 1;
+	for (int half = E >> 1; half > 0; half >>= 1) {
+		if (way & half) {
+			*bits &= ~(1ULL << node);
+			node = 2 * node + 1;
+		} else {
+			*bits |= 1ULL << node;
+			node = 2 * node;
+		}
+	}
+}
+
+/*
+ * plru_victim:
+ * Follows the tree bits from the root to the pseudo-LRU way.
+ */
+static inline int plru_victim(unsigned long long bits, int E) {
+	int node = 1;
+	int way = 0;
+	for (int half = E >> 1; half > 0; half >>= 1) {
+		if (bits & (1ULL << node)) {
+			way |= half;
+			node = 2 * node + 1;
+		} else {
+			node = 2 * node;
+		}
+	}
+	return way;
+}
+
+/*
+ * bitplru_touch:
+ * Sets the MRU bit of "way", clearing the others once they'd all be set.
+ */
+static inline void bitplru_touch(unsigned long long *bits, int E, int way) {
+	*bits |= 1ULL << way;
+	unsigned long long all = E == 64 ? ~0ULL : (1ULL << E) - 1;
+	if (*bits == all) {
+		*bits = 1ULL << way;
+	}
+}
+
+/*
+ * policy_hit:
+ * Updates the replacement state after a hit on line "way".
+ */
+static inline void policy_hit(cache_sim_t *c, int set_index, cache_line_t *line, int way) {
+	switch (c->policy) {
+		case POLICY_LRU:
+			line->counter = c->stamp;
+			break;
+		case POLICY_LFU:
+			line->counter++;
+			break;
+		case POLICY_SRRIP:
+		case POLICY_BRRIP:
+			line->counter = 0;
+			break;
+		case POLICY_PLRU:
+			plru_touch(&c->set_state[set_index], c->E, way);
+			break;
+		case POLICY_BITPLRU:
+			bitplru_touch(&c->set_state[set_index], c->E, way);
+			break;
+	}
+}
+
+/*
+ * policy_fill:
+ * Sets the replacement state of line "way" which was just filled.
+ */
+static inline void policy_fill(cache_sim_t *c, int set_index, cache_line_t *line, int way) {
+	switch (c->policy) {
+		case POLICY_LRU:
+		case POLICY_FIFO:
+			line->counter = c->stamp;
+			break;
+		case POLICY_LFU:
+			line->counter = 1;
+			break;
+		case POLICY_SRRIP:
+			line->counter = RRPV_MAX - 1;
+			break;
+		case POLICY_BRRIP:
+			line->counter = set_random(&c->set_state[set_index]) % BRRIP_EPSILON == 0
+					? RRPV_MAX - 1 : RRPV_MAX;
+			break;
+		case POLICY_PLRU:
+			plru_touch(&c->set_state[set_index], c->E, way);
+			break;
+		case POLICY_BITPLRU:
+			bitplru_touch(&c->set_state[set_index], c->E, way);
+			break;
+	}
+}
+
+/*
+ * policy_victim:
+ * Picks the line to evict from a full set. "min_index" is the line with the
+ * smallest counter, which is the victim for LRU, FIFO and LFU.
+ */
+static inline int policy_victim(cache_sim_t *c, int set_index, cache_set_t set, int min_index) {
+	switch (c->policy) {
+		case POLICY_RANDOM:
+			return set_random(&c->set_state[set_index]) % c->E;
+		case POLICY_PLRU:
+			return plru_victim(c->set_state[set_index], c->E);
+		case POLICY_BITPLRU:
+			return __builtin_ctzll(~c->set_state[set_index]);
+		case POLICY_SRRIP:
+		case POLICY_BRRIP: {
+			// age every line so the most distant one reaches RRPV_MAX
+			int victim = 0;
+			for (int i = 1; i < c->E; i++) {
+				if (set[i].counter > set[victim].counter) {
+					victim = i;
+				}
+			}
+			unsigned long long age = RRPV_MAX - set[victim].counter;
+			if (age) {
+				for (int i = 0; i < c->E; i++) {
+					set[i].counter += age;
+				}
+			}
+			return victim;
+		}
+		default:
+			return min_index;
+	}
+}
+
+/*
+ * cache_access_rw:
+ * Simulates a load (write = 0) or a store of "len" bytes (write = 1) at
+ * given "addr" memory address in cache "c" and updates its counters.
+ * Returns ACCESS_HIT, ACCESS_MISS or ACCESS_EVICT.
+ *
+ * A miss fills the first invalid line of the set; only a full set asks the
+ * replacement policy for a victim. For LRU each line is stamped with the
+ * cache's access count when used, so the smallest stamp is the LRU line.
+ *
+ * Write-back caches mark stored lines dirty and write whole blocks to memory
+ * when a dirty line is evicted. Write-through caches send every store's
+ * bytes to memory. Without write-allocate a store miss goes straight to
+ * memory and leaves the cache alone.
+ */
+static inline int cache_access_rw(cache_sim_t *c, mem_addr_t addr, int write, unsigned int len) {
+	// get the set and the tag
+	int set_index = (addr >> c->b) & (c->S - 1);
+	cache_set_t set = c->sets[set_index];
+	mem_addr_t tag = addr >> (c->s + c->b);
+	c->stamp++;
+
+	int empty_index = -1;
+	int min_index = 0;
+
+	for (int i = 0; i < c->E; i++) {
+		cache_line_t *line = &set[i];
+
+		if (line->valid) {
+			// cache hit if the line is valid and has the requested tag
+			if (line->tag == tag) {
+				policy_hit(c, set_index, line, i);
+				c->hits++;
+				if (line->prefetched) {
+					line->prefetched = 0;
+					c->prefetch_hit = 1;
+				}
+				if (write) {
+					if (c->write_through) {
+						c->mem_write_bytes += len;
+					} else {
+						line->dirty = 1;
+					}
+				}
+				return ACCESS_HIT;
+			}
+			if (line->counter < set[min_index].counter) {
+				min_index = i;
+			}
+		} else if (empty_index == -1) {
+			empty_index = i;
+		}
+	}
+
+	// cache miss
+	c->misses++;
+	if (write && (c->write_through || !c->write_allocate)) {
+		c->mem_write_bytes += len;
+		if (!c->write_allocate) {
+			return ACCESS_MISS;
+		}
+	}
+	c->mem_read_bytes += c->B;
+
+	// fill the first empty line in the set if there is one
+	int way = empty_index;
+	int result = ACCESS_MISS;
+	if (way == -1) {
+		// no empty line found, evict the policy's victim
+		way = policy_victim(c, set_index, set, min_index);
+		c->evictions++;
+		if (set[way].dirty) {
+			c->writebacks++;
+			c->mem_write_bytes += c->B;
+		}
+		result = ACCESS_EVICT;
+	}
+
+	set[way].valid = 1;
+	set[way].dirty = write && !c->write_through;
+	set[way].prefetched = 0;
+	set[way].tag = tag;
+	policy_fill(c, set_index, &set[way], way);
+	return result;
+}
+
+/*
+ * cache_access:
+ * Simulates a load at given "addr" memory address in cache "c".
+ */
+int cache_access(cache_sim_t *c, mem_addr_t addr) {
+	return cache_access_rw(c, addr, 0, 0);
+}
+
+/*
+ * cache_replay:
+ * Applies one decoded trace access to cache "c": a load, a store, or for
+ * M a load followed by a store.
+ */
+static inline void cache_replay(cache_sim_t *c, const trace_access_t *acc) {
+	if (acc->op == 'S') {
+		cache_access_rw(c, acc->addr, 1, acc->len);
+	} else {
+		cache_access_rw(c, acc->addr, 0, 0);
+		if (acc->op == 'M') {
+			cache_access_rw(c, acc->addr, 1, acc->len);
+		}
+	}
+}
+
+/*
+ * cache_probe:
+ * Looks up the block holding "addr" without filling on a miss. Returns its
+ * line, or NULL if it isn't cached. A found line counts as used by the
+ * replacement policy when "touch" is set. Doesn't update the counters.
+ */
+static inline cache_line_t *cache_probe(cache_sim_t *c, mem_addr_t addr, int touch) {
+	int set_index = (addr >> c->b) & (c->S - 1);
+	cache_set_t set = c->sets[set_index];
+	mem_addr_t tag = addr >> (c->s + c->b);
+	c->stamp++;
+
+	for (int i = 0; i < c->E; i++) {
+		if (set[i].valid && set[i].tag == tag) {
+			if (touch) {
+				policy_hit(c, set_index, &set[i], i);
+			}
+			return &set[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * cache_install:
+ * Fills the block holding "addr", which must not be cached, with the given
+ * dirty bit, marked as prefetched if it's filled by a prefetch. If a valid
+ * line had to be evicted, counts the eviction, stores the victim's block
+ * address and dirty bit and returns 1; else returns 0.
+ */
+static inline void prefetch_evicted(prefetcher_t *pf, int b, mem_addr_t victim);
+
+static inline int cache_install(cache_sim_t *c, mem_addr_t addr, int dirty, int prefetched,
+		mem_addr_t *victim_addr, int *victim_dirty) {
+	int set_index = (addr >> c->b) & (c->S - 1);
+	cache_set_t set = c->sets[set_index];
+	mem_addr_t tag = addr >> (c->s + c->b);
+	c->stamp++;
+
+	int empty_index = -1;
+	int min_index = 0;
+	for (int i = 0; i < c->E; i++) {
+		if (!set[i].valid) {
+			empty_index = i;
+			break;
+		}
+		if (set[i].counter < set[min_index].counter) {
+			min_index = i;
+		}
+	}
+
+	int way = empty_index;
+	int evicted = 0;
+	if (way == -1) {
+		way = policy_victim(c, set_index, set, min_index);
+		*victim_addr = (set[way].tag << (c->s + c->b)) | ((mem_addr_t) set_index << c->b);
+		*victim_dirty = set[way].dirty;
+		c->evictions++;
+		evicted = 1;
+		if (prefetched) {
+			prefetch_evicted(c->pf, c->b, *victim_addr);
+		}
+	}
+
+	set[way].valid = 1;
+	set[way].dirty = dirty;
+	set[way].prefetched = prefetched;
+	set[way].tag = tag;
+	policy_fill(c, set_index, &set[way], way);
+	return evicted;
+}
+
+/*
+ * cache_remove:
+ * Invalidates the block holding "addr". Returns 1 and stores its dirty bit
+ * if it was cached, else returns 0.
+ */
+static inline int cache_remove(cache_sim_t *c, mem_addr_t addr, int *dirty) {
+	cache_line_t *line = cache_probe(c, addr, 0);
+	if (line == NULL) {
+		return 0;
+	}
+	*dirty = line->dirty;
+	line->valid = 0;
+	line->dirty = 0;
+	return 1;
+}
+
+/* TODO - COMPLETE THIS FUNCTION
+ * init_cache:
+ * Allocates the data structure for a cache with S sets and E lines per set.
+ * Initializes all valid bits and tags with 0s.
+ */
+void init_cache() {
+	cache_init(&sim, s, E, b);
+	S = sim.S;
+	B = sim.B;
+	cache = sim.sets;
+}
+
+/* TODO - COMPLETE THIS FUNCTION
+ * free_cache:
+ * Frees all heap allocated memory used by the cache.
+ */
+void free_cache() {
+	cache_free(&sim);
+	cache = NULL;
+}
+
+
+/******************************************************************************/
+/* Address hash map ***********************************************************/
+
+//Key that marks an unused slot in an addr_map_t.
+#define ADDR_MAP_EMPTY (~0ULL)
+
+//Type addr_map_entry_t: One key/value pair of an addr_map_t.
+typedef struct addr_map_entry {
+	mem_addr_t key;
+	long long value;
+} addr_map_entry_t;
+
+//Type addr_map_t: Open addressing hash map from block addresses to a value.
+//Grows by doubling when more than half full. The all-ones address can't be
+//used as a key.
+typedef struct addr_map {
+	addr_map_entry_t *slots;
+	unsigned long long mask; //capacity - 1, capacity is a power of 2
+	unsigned long long count;
+} addr_map_t;
+
+/*
+ * addr_hash:
+ * Mixes the bits of an address so that strided block numbers spread out.
+ */
+static inline unsigned long long addr_hash(mem_addr_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/*
+ * addr_map_init:
+ * Allocates an empty map with room for at least "capacity" slots.
+ */
+void addr_map_init(addr_map_t *map, unsigned long long capacity) {
+	unsigned long long cap = 16;
+	while (cap < capacity) cap *= 2;
+
+	map->slots = malloc(sizeof(addr_map_entry_t) * cap);
+	if (map->slots == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	for (unsigned long long i = 0; i < cap; i++) {
+		map->slots[i].key = ADDR_MAP_EMPTY;
+	}
+	map->mask = cap - 1;
+	map->count = 0;
+}
+
+/*
+ * addr_map_free:
+ * Frees the slots of a map.
+ */
+void addr_map_free(addr_map_t *map) {
+	free(map->slots);
+	map->slots = NULL;
+}
+
+/*
+ * addr_map_find:
+ * Returns the entry for "key", or NULL if the key isn't in the map.
+ */
+static inline addr_map_entry_t *addr_map_find(addr_map_t *map, mem_addr_t key) {
+	unsigned long long i = addr_hash(key) & map->mask;
+
+	while (map->slots[i].key != ADDR_MAP_EMPTY) {
+		if (map->slots[i].key == key) {
+			return &map->slots[i];
+		}
+		i = (i + 1) & map->mask;
+	}
+	return NULL;
+}
+
+/*
+ * addr_map_insert:
+ * Returns the entry for "key", adding it with "value" if it isn't already
+ * in the map. "*added" is set to whether the key was new.
+ */
+addr_map_entry_t *addr_map_insert(addr_map_t *map, mem_addr_t key, long long value, int *added) {
+	if ((map->count + 1) * 2 > map->mask + 1) {
+		addr_map_t bigger;
+		addr_map_init(&bigger, (map->mask + 1) * 2);
+		for (unsigned long long i = 0; i <= map->mask; i++) {
+			if (map->slots[i].key != ADDR_MAP_EMPTY) {
+				unsigned long long j = addr_hash(map->slots[i].key) & bigger.mask;
+				while (bigger.slots[j].key != ADDR_MAP_EMPTY) {
+					j = (j + 1) & bigger.mask;
+				}
+				bigger.slots[j] = map->slots[i];
+			}
+		}
+		bigger.count = map->count;
+		addr_map_free(map);
+		*map = bigger;
+	}
+
+	unsigned long long i = addr_hash(key) & map->mask;
+	while (map->slots[i].key != ADDR_MAP_EMPTY) {
+		if (map->slots[i].key == key) {
+			*added = 0;
+			return &map->slots[i];
+		}
+		i = (i + 1) & map->mask;
+	}
+
+	map->slots[i].key = key;
+	map->slots[i].value = value;
+	map->count++;
+	*added = 1;
+	return &map->slots[i];
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Miss attribution ***********************************************************/
+
+//Slots in each hot table, and how many neighbouring slots a key may use.
+#define HOT_TABLE_SIZE 4096
+#define HOT_PROBES 8
+
+//Type hot_entry_t: Miss count of one block or instruction in a hot table.
+typedef struct hot_entry {
+	mem_addr_t key;
+	long long misses;
+	long long error; //count inherited from the entry it replaced
+	int used;
+} hot_entry_t;
+
+//Type addr_range_t: A named address range from the -R map.
+typedef struct addr_range {
+	mem_addr_t start;
+	mem_addr_t end; //exclusive
+	char name[64];
+	long long accesses;
+	long long misses;
+	long long evictions;
+} addr_range_t;
+
+//Type attribution_t: Where the misses of a serial run come from.
+//Memory is fixed up front: two counters per set, the ranges from the map
+//and two hot tables that keep approximate counts for the hottest blocks
+//and instructions in the style of the Space-Saving algorithm: a key that
+//finds no free slot replaces the smallest count in its probe window and
+//carries that count as its possible overestimate.
+typedef struct attribution {
+	int top_n;
+	long long *set_misses;
+	long long *set_evictions;
+	hot_entry_t *blocks;
+	hot_entry_t *pcs;
+	addr_range_t *ranges; //sorted by start, not overlapping
+	int num_ranges;
+	long long other_misses; //misses outside every range
+} attribution_t;
+
+//Set by -A and -R; NULL when attribution is off.
+attribution_t *attribution = NULL;
+
+//Address of the instruction that made the current access, taken from the
+//trace's I lines.
+mem_addr_t current_pc = 0;
+
+//Set while the current access is a later piece of an access split by -l.
+int current_cont = 0;
+
+/*
+ * hot_add:
+ * Counts a miss for "key" in a hot table.
+ */
+void hot_add(hot_entry_t *table, mem_addr_t key) {
+	unsigned long long h = addr_hash(key);
+	hot_entry_t *min = NULL;
+
+	for (int i = 0; i < HOT_PROBES; i++) {
+		hot_entry_t *e = &table[(h + i) & (HOT_TABLE_SIZE - 1)];
+		if (!e->used || e->key == key) {
+			if (!e->used) {
+				e->used = 1;
+				e->key = key;
+			}
+			e->misses++;
+			return;
+		}
+		if (min == NULL || e->misses < min->misses) {
+			min = e;
+		}
+	}
+
+	min->key = key;
+	min->error = min->misses;
+	min->misses++;
+}
+
+/*
+ * hot_cmp:
+ * qsort comparator putting the most missed hot entries first.
+ */
+int hot_cmp(const void *a, const void *b) {
+	const hot_entry_t *x = a;
+	const hot_entry_t *y = b;
+	return (y->misses > x->misses) - (y->misses < x->misses);
+}
+
+/*
+ * range_cmp:
+ * qsort comparator ordering address ranges by start.
+ */
+int range_cmp(const void *a, const void *b) {
+	const addr_range_t *x = a;
+	const addr_range_t *y = b;
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * load_ranges:
+ * Reads the address range map: one "start end name" line per range with
+ * hex addresses and an exclusive end, e.g. "601040 6a1040 arr2D".
+ * Lines starting with # are comments.
+ */
+void load_ranges(attribution_t *a, char *map_fn) {
+	FILE *fp = fopen(map_fn, "r");
+	char buf[256];
+	int cap = 16;
+
+	if (!fp) {
+		fprintf(stderr, "%s: %s\n", map_fn, strerror(errno));
+		exit(1);
+	}
+	a->ranges = malloc(sizeof(addr_range_t) * cap);
+	if (a->ranges == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		addr_range_t range;
+		memset(&range, 0, sizeof(range));
+		if (buf[0] == '#' || buf[0] == '\n') continue;
+		if (sscanf(buf, "%llx %llx %63s", &range.start, &range.end, range.name) != 3
+				|| range.end <= range.start) {
+			fprintf(stderr, "%s: bad range \"%s\"\n", map_fn, buf);
+			exit(1);
+		}
+		if (a->num_ranges == cap) {
+			cap *= 2;
+			a->ranges = realloc(a->ranges, sizeof(addr_range_t) * cap);
+			if (a->ranges == NULL) {
+				printf("Error: malloc failed");
+				exit(1);
+			}
+		}
+		a->ranges[a->num_ranges++] = range;
+	}
+	fclose(fp);
+
+	qsort(a->ranges, a->num_ranges, sizeof(addr_range_t), range_cmp);
+	for (int i = 1; i < a->num_ranges; i++) {
+		if (a->ranges[i].start < a->ranges[i - 1].end) {
+			fprintf(stderr, "%s: ranges %s and %s overlap\n", map_fn,
+					a->ranges[i - 1].name, a->ranges[i].name);
+			exit(1);
+		}
+	}
+}
+
+/*
+ * attribution_init:
+ * Turns attribution on for the cache behind access_data(), reporting the
+ * "top_n" hottest sets, blocks and instructions and, if "map_fn" isn't
+ * NULL, per range counts.
+ */
+void attribution_init(int top_n, char *map_fn) {
+	attribution_t *a = calloc(1, sizeof(attribution_t));
+	if (a == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	a->top_n = top_n;
+	a->set_misses = calloc(S, sizeof(long long));
+	a->set_evictions = calloc(S, sizeof(long long));
+	a->blocks = calloc(HOT_TABLE_SIZE, sizeof(hot_entry_t));
+	a->pcs = calloc(HOT_TABLE_SIZE, sizeof(hot_entry_t));
+	if (a->set_misses == NULL || a->set_evictions == NULL
+			|| a->blocks == NULL || a->pcs == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	if (map_fn != NULL) {
+		load_ranges(a, map_fn);
+	}
+	attribution = a;
+}
+
+/*
+ * find_range:
+ * Returns the range holding "addr", or NULL if none does.
+ */
+addr_range_t *find_range(attribution_t *a, mem_addr_t addr) {
+	int lo = 0;
+	int hi = a->num_ranges - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (addr < a->ranges[mid].start) {
+			hi = mid - 1;
+		} else if (addr >= a->ranges[mid].end) {
+			lo = mid + 1;
+		} else {
+			return &a->ranges[mid];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * attribute_access:
+ * Charges the result of one access at "addr" to its set, block,
+ * instruction and range.
+ */
+void attribute_access(attribution_t *a, mem_addr_t addr, int result) {
+	addr_range_t *range = a->num_ranges ? find_range(a, addr) : NULL;
+	if (range != NULL) {
+		range->accesses++;
+	}
+	if (result == ACCESS_HIT) {
+		return;
+	}
+
+	int set_index = (addr >> b) & (S - 1);
+	a->set_misses[set_index]++;
+	hot_add(a->blocks, addr >> b);
+	hot_add(a->pcs, current_pc);
+
+	if (result == ACCESS_EVICT) {
+		a->set_evictions[set_index]++;
+	}
+	if (range != NULL) {
+		range->misses++;
+		range->evictions += result == ACCESS_EVICT;
+	} else if (a->num_ranges) {
+		a->other_misses++;
+	}
+}
+
+/*
+ * print_hot:
+ * Prints the "top_n" entries of a hot table with the most misses.
+ */
+void print_hot(hot_entry_t *table, int top_n, const char *title, int block_bits) {
+	qsort(table, HOT_TABLE_SIZE, sizeof(hot_entry_t), hot_cmp);
+	printf("%s:\n", title);
+	for (int i = 0; i < top_n && i < HOT_TABLE_SIZE && table[i].used; i++) {
+		printf("  %16llx misses:%lld", table[i].key << block_bits, table[i].misses);
+		if (table[i].error) {
+			printf(" (at most %lld over)", table[i].error);
+		}
+		printf("\n");
+	}
+}
+
+/*
+ * print_attribution:
+ * Prints the hottest sets, blocks and instructions and the range counts.
+ */
+void print_attribution(attribution_t *a) {
+	int *order = malloc(sizeof(int) * S);
+	long long used_sets = 0;
+	if (order == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	// selection of the top sets, S is small enough for a partial sort
+	for (int i = 0; i < S; i++) {
+		order[i] = i;
+		used_sets += a->set_misses[i] != 0;
+	}
+	printf("sets with misses:%lld of %d, mean misses per set:%.1f\n",
+			used_sets, S, (double) miss_cnt / S);
+	printf("hottest sets:\n");
+	for (int k = 0; k < a->top_n && k < S; k++) {
+		int best = k;
+		for (int i = k + 1; i < S; i++) {
+			if (a->set_misses[order[i]] > a->set_misses[order[best]]) {
+				best = i;
+			}
+		}
+		int tmp = order[k];
+		order[k] = order[best];
+		order[best] = tmp;
+		if (a->set_misses[order[k]] == 0) break;
+		printf("  set %8d misses:%lld evictions:%lld\n", order[k],
+				a->set_misses[order[k]], a->set_evictions[order[k]]);
+	}
+	free(order);
+
+	print_hot(a->blocks, a->top_n, "hottest blocks", b);
+	print_hot(a->pcs, a->top_n, "hottest instructions", 0);
+
+	if (a->num_ranges) {
+		printf("ranges:\n");
+		for (int i = 0; i < a->num_ranges; i++) {
+			addr_range_t *r = &a->ranges[i];
+			printf("  %-20s accesses:%lld misses:%lld evictions:%lld\n",
+					r->name, r->accesses, r->misses, r->evictions);
+		}
+		printf("  %-20s misses:%lld\n", "[other]", a->other_misses);
+	}
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Miss classification ********************************************************/
+
+//Type classify_t: Sorts the misses of a serial run into the three Cs.
+//A miss on a block never seen before is compulsory. Otherwise it's a
+//capacity miss if a fully associative LRU cache of the same size would
+//also have missed, and a conflict miss if that cache would have hit.
+//
+//The shadow fully associative cache is a hash map from block to node plus
+//an intrusive doubly linked list of nodes in LRU order, so every access is
+//O(1) no matter how many lines it has. The same map remembers the blocks
+//that were touched before: they stay in it with node -1 once the shadow
+//cache drops them, so one lookup per access answers both questions.
+typedef struct classify {
+	addr_map_t blocks;   //every block touched -> shadow node, or -1
+	mem_addr_t *keys;    //node -> block
+	int *prev;           //node -> more recently used node, -1 at the head
+	int *next;           //node -> less recently used node, -1 at the tail
+	int head;
+	int tail;
+	int capacity;        //lines in the cache, S * E
+	int used;
+	long long compulsory;
+	long long capacity_misses;
+	long long conflict;
+} classify_t;
+
+//Set by -C; NULL when classification is off.
+classify_t *classify = NULL;
+
+/*
+ * classify_init:
+ * Turns classification on for the cache behind access_data().
+ */
+void classify_init() {
+	classify_t *c = calloc(1, sizeof(classify_t));
+	if (c == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	c->capacity = S * E;
+	c->keys = malloc(sizeof(mem_addr_t) * c->capacity);
+	c->prev = malloc(sizeof(int) * c->capacity);
+	c->next = malloc(sizeof(int) * c->capacity);
+	if (c->keys == NULL || c->prev == NULL || c->next == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	c->head = c->tail = -1;
+	addr_map_init(&c->blocks, 2 * (unsigned long long) c->capacity);
+	classify = c;
+}
+
+/*
+ * shadow_unlink:
+ * Takes a node out of the shadow LRU list.
+ */
+static inline void shadow_unlink(classify_t *c, int node) {
+	if (c->prev[node] != -1) c->next[c->prev[node]] = c->next[node];
+	else c->head = c->next[node];
+	if (c->next[node] != -1) c->prev[c->next[node]] = c->prev[node];
+	else c->tail = c->prev[node];
+}
+
+/*
+ * shadow_push_front:
+ * Makes a node the most recently used one.
+ */
+static inline void shadow_push_front(classify_t *c, int node) {
+	c->prev[node] = -1;
+	c->next[node] = c->head;
+	if (c->head != -1) c->prev[c->head] = node;
+	c->head = node;
+	if (c->tail == -1) c->tail = node;
+}
+
+/*
+ * shadow_access:
+ * Accesses "block" in the shadow fully associative LRU cache. Returns 1 on
+ * a hit and 0 on a miss; "*first" is set if the block was never touched.
+ */
+int shadow_access(classify_t *c, mem_addr_t block, int *first) {
+	addr_map_entry_t *e = addr_map_insert(&c->blocks, block, -1, first);
+
+	if (e->value >= 0) {
+		int node = e->value;
+		if (node != c->head) {
+			shadow_unlink(c, node);
+			shadow_push_front(c, node);
+		}
+		return 1;
+	}
+
+	int node;
+	if (c->used < c->capacity) {
+		node = c->used++;
+	} else {
+		// evict the least recently used block, it stays known as touched
+		node = c->tail;
+		shadow_unlink(c, node);
+		addr_map_find(&c->blocks, c->keys[node])->value = -1;
+	}
+
+	c->keys[node] = block;
+	e->value = node;
+	shadow_push_front(c, node);
+	return 0;
+}
+
+/*
+ * classify_access:
+ * Feeds one access of the real cache, with its result, to the classifier.
+ */
+void classify_access(classify_t *c, mem_addr_t addr, int result) {
+	int first;
+	int shadow_hit = shadow_access(c, addr >> b, &first);
+
+	if (result == ACCESS_HIT) {
+		return;
+	}
+
+	if (first) {
+		c->compulsory++;
+	} else if (shadow_hit) {
+		c->conflict++;
+	} else {
+		c->capacity_misses++;
+	}
+}
+
+/*
+ * print_classify:
+ * Prints the three kinds of misses.
+ */
+void print_classify(classify_t *c) {
+	printf("compulsory:%lld capacity:%lld conflict:%lld\n",
+			c->compulsory, c->capacity_misses, c->conflict);
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Prefetching ****************************************************************/
+
+//Events a prefetcher observes for each demand access.
+#define PF_HIT            0
+#define PF_MISS           1
+#define PF_PREFETCHED_HIT 2 //first demand hit on a prefetched line
+
+/*
+ * prefetch_parse:
+ * Builds a prefetcher from "name" or "name:degree", or returns NULL for
+ * "none". The degree is the number of lines fetched ahead (default 1, or 4
+ * for the stream model).
+ */
+prefetcher_t *prefetch_parse(const char *spec) {
+	int kind;
+	int degree = 0;
+	const char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t) (colon - spec) : strlen(spec);
+
+	for (kind = 0; kind < 4; kind++) {
+		if (strlen(prefetch_names[kind]) == len && strncmp(spec, prefetch_names[kind], len) == 0)
+			break;
+	}
+	if (colon != NULL) {
+		degree = atoi(colon + 1);
+	}
+	if (kind == 4 || degree < 0 || degree > MAX_PREFETCH_DEGREE) {
+		fprintf(stderr, "Bad prefetcher \"%s\"\n", spec);
+		exit(1);
+	}
+	if (kind == PREFETCH_NONE) {
+		return NULL;
+	}
+
+	prefetcher_t *pf = calloc(1, sizeof(prefetcher_t));
+	if (pf == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	pf->kind = kind;
+	pf->degree = degree ? degree : (kind == PREFETCH_STREAM ? 4 : 1);
+	return pf;
+}
+
+/*
+ * prefetch_parse_list:
+ * Attaches the comma separated prefetchers in "spec" to "num" caches in
+ * order. Caches past the end of the list get none.
+ */
+void prefetch_parse_list(char *spec, cache_sim_t *caches, int num) {
+	char *copy = strdup(spec);
+	char *save = NULL;
+	int i = 0;
+
+	for (char *item = strtok_r(copy, ",", &save); item != NULL;
+			item = strtok_r(NULL, ",", &save)) {
+		if (i == num) {
+			fprintf(stderr, "More prefetchers than cache levels in \"%s\"\n", spec);
+			exit(1);
+		}
+		caches[i++].pf = prefetch_parse(item);
+	}
+	free(copy);
+}
+
+/*
+ * prefetch_candidates:
+ * Feeds one demand access at "addr" by instruction "pc" to the model and
+ * writes the block addresses it wants fetched to "out" (at most
+ * MAX_PREFETCH_DEGREE). Returns how many.
+ */
+int prefetch_candidates(prefetcher_t *pf, int b, mem_addr_t addr, mem_addr_t pc,
+		int event, mem_addr_t *out) {
+	mem_addr_t block = addr >> b;
+	int n = 0;
+
+	switch (pf->kind) {
+		case PREFETCH_NEXT:
+			// tagged: a miss or the first use of a prefetched line
+			if (event != PF_HIT) {
+				for (int k = 1; k <= pf->degree; k++) {
+					out[n++] = (block + k) << b;
+				}
+			}
+			break;
+
+		case PREFETCH_STRIDE: {
+			// the later pieces of a split access are the same instruction
+			// one block on, and would break the stride it's learning
+			if (current_cont) break;
+			rpt_entry_t *e = &pf->rpt[addr_hash(pc) % RPT_SIZE];
+			if (e->pc != pc) {
+				e->pc = pc;
+				e->last = addr;
+				e->stride = 0;
+				e->state = 0;
+				break;
+			}
+
+			long long delta = addr - e->last;
+			if (delta != 0 && delta == e->stride) {
+				if (e->state < 2) e->state++;
+				for (int k = 1; k <= pf->degree; k++) {
+					mem_addr_t target = (addr + e->stride * k) >> b;
+					if (target != block && (n == 0 || target != out[n - 1] >> b)) {
+						out[n++] = target << b;
+					}
+				}
+			} else if (e->state == 2) {
+				e->state = 1; // one irregular access doesn't lose the stride
+			} else {
+				e->stride = delta;
+				e->state = 0;
+			}
+			e->last = addr;
+			break;
+		}
+
+		case PREFETCH_STREAM: {
+			if (event == PF_HIT) break;
+			stream_t *match = NULL;
+			stream_t *lru = &pf->streams[0];
+			pf->stamp++;
+
+			for (int i = 0; i < STREAMS && match == NULL; i++) {
+				stream_t *st = &pf->streams[i];
+				long long delta = (long long) (block - st->last);
+				if (st->used == 0) {
+					// never allocated
+				} else if (st->dir == 0 && delta != 0 && llabs(delta) <= pf->degree) {
+					st->dir = delta > 0 ? 1 : -1;
+					st->ahead = block;
+					match = st;
+				} else if (st->dir != 0 && delta * st->dir > 0 && delta * st->dir <= pf->degree) {
+					match = st;
+				}
+				if (st->used < lru->used) {
+					lru = st;
+				}
+			}
+
+			if (match == NULL) {
+				if (event == PF_MISS) {
+					lru->last = lru->ahead = block;
+					lru->dir = 0;
+					lru->used = pf->stamp;
+				}
+				break;
+			}
+
+			// keep the stream "degree" blocks ahead of its last access
+			match->last = block;
+			match->used = pf->stamp;
+			mem_addr_t target = match->ahead;
+			if ((long long) (target - block) * match->dir < 0) {
+				target = block;
+			}
+			while (n < pf->degree && (long long) (target + match->dir - block) * match->dir <= pf->degree) {
+				target += match->dir;
+				out[n++] = target << b;
+			}
+			match->ahead = target;
+			break;
+		}
+	}
+	return n;
+}
+
+/*
+ * prefetch_observe:
+ * Updates a cache's prefetch counters for one demand access and returns
+ * the blocks its prefetcher wants, like prefetch_candidates().
+ */
+int prefetch_observe(prefetcher_t *pf, int b, mem_addr_t addr, int event, mem_addr_t *out) {
+	mem_addr_t block = addr >> b;
+
+	if (event == PF_PREFETCHED_HIT) {
+		pf->useful++;
+	} else if (event == PF_MISS) {
+		pf->uncovered++;
+		mem_addr_t *victim = &pf->victims[addr_hash(block) % POLLUTION_FILTER];
+		if (*victim == block + 1) {
+			pf->pollution++;
+			*victim = 0;
+		}
+	}
+	return prefetch_candidates(pf, b, addr, current_pc, event, out);
+}
+
+/*
+ * prefetch_evicted:
+ * Remembers a block that a prefetch fill pushed out of the cache.
+ */
+static inline void prefetch_evicted(prefetcher_t *pf, int b, mem_addr_t victim) {
+	mem_addr_t block = victim >> b;
+	pf->victims[addr_hash(block) % POLLUTION_FILTER] = block + 1;
+}
+
+/*
+ * cache_prefetch:
+ * Prefetches the block of "addr" into a single level cache unless it's
+ * already there, counting the memory traffic.
+ */
+void cache_prefetch(cache_sim_t *c, mem_addr_t addr) {
+	mem_addr_t victim;
+	int victim_dirty;
+
+	if (cache_probe(c, addr, 0) != NULL) {
+		return;
+	}
+	c->pf->issued++;
+	c->mem_read_bytes += c->B;
+	if (cache_install(c, addr, 0, 1, &victim, &victim_dirty) && victim_dirty) {
+		c->writebacks++;
+		c->mem_write_bytes += c->B;
+	}
+}
+
+/*
+ * print_prefetch:
+ * Prints the counters of a cache's prefetcher. Accuracy is the share of
+ * prefetches that were used, coverage the share of would-be misses they
+ * turned into hits.
+ */
+void print_prefetch(const char *label, prefetcher_t *pf) {
+	long long would_miss = pf->useful + pf->uncovered;
+	printf("%sprefetch:%s:%d issued:%lld useful:%lld accuracy:%.4f coverage:%.4f pollution:%lld\n",
+			label, prefetch_names[pf->kind], pf->degree, pf->issued, pf->useful,
+			pf->issued ? (double) pf->useful / pf->issued : 0.0,
+			would_miss ? (double) pf->useful / would_miss : 0.0, pf->pollution);
+}
+/******************************************************************************/
+
+
+/*
+ * access_data_rw:
+ * Simulates a load or a store of "len" bytes at "addr" in the cache and
+ * updates hit_cnt, miss_cnt and evict_cnt.
+ */
+void access_data_rw(mem_addr_t addr, int write, unsigned int len) {
+	int result = cache_access_rw(&sim, addr, write, len);
+
+	if (sim.pf != NULL) {
+		mem_addr_t targets[MAX_PREFETCH_DEGREE];
+		int event = result != ACCESS_HIT ? PF_MISS : sim.prefetch_hit ? PF_PREFETCHED_HIT : PF_HIT;
+		int n = prefetch_observe(sim.pf, b, addr, event, targets);
+		sim.prefetch_hit = 0;
+		for (int i = 0; i < n; i++) {
+			cache_prefetch(&sim, targets[i]);
+		}
+	}
+
+	if (attribution != NULL) {
+		attribute_access(attribution, addr, result);
+	}
+	if (classify != NULL) {
+		classify_access(classify, addr, result);
+	}
+
+	if (result == ACCESS_HIT) {
+		hit_cnt++;
+	} else {
+		miss_cnt++;
+		if (result == ACCESS_EVICT) {
+			evict_cnt++;
+		}
+	}
+}
+
+/* TODO - COMPLETE THIS FUNCTION
+ * access_data:
+ * Simulates data access at given "addr" memory address in the cache.
+ *
+ * If already in cache, increment hit_cnt
+ * If not in cache, cache it (set tag), increment miss_cnt
+ * If a line is evicted, increment evict_cnt
+ */
+void access_data(mem_addr_t addr) {
+	access_data_rw(addr, 0, 0);
+}
+
+/*
+ * parse_hex:
+ * Parses the hex number at "*p" and moves "*p" past it.
+ */
+static inline mem_addr_t parse_hex(const char **p) {
+	const char *q = *p;
+	mem_addr_t value = 0;
+	for (;; q++) {
+		unsigned int digit;
+		if (*q >= '0' && *q <= '9') digit = *q - '0';
+		else if (*q >= 'a' && *q <= 'f') digit = *q - 'a' + 10;
+		else if (*q >= 'A' && *q <= 'F') digit = *q - 'A' + 10;
+		else break;
+		value = (value << 4) | digit;
+	}
+	*p = q;
+	return value;
+}
+
+/*
+ * parse_trace_line:
+ * Decodes one line of a Valgrind trace into "acc".
+ * Returns 1 for a data access (L/S/M) and 0 for anything else.
+ *
+ * Lines look like " L 04f6b868,8"; instruction loads start with 'I' in the
+ * first column and are skipped.
+ */
+int parse_trace_line(const char *buf, trace_access_t *acc) {
+	char op = buf[1];
+	if (buf[0] != ' ' || (op != 'S' && op != 'L' && op != 'M')) {
+		return 0;
+	}
+
+	const char *p = buf + 3;
+	mem_addr_t addr = parse_hex(&p);
+
+	unsigned int len = 0;
+	if (*p == ',') {
+		for (p++; *p >= '0' && *p <= '9'; p++) {
+			len = len * 10 + (*p - '0');
+		}
+	}
+
+	acc->addr = addr;
+	acc->pc = 0;
+	acc->len = len;
+	acc->op = op;
+	acc->core = 0;
+	acc->cont = 0;
+	return 1;
+}
+
+/*
+ * trace_reader_run:
+ * Reader thread: fills the two chunks in turn from the input, waiting
+ * while the parser still owns the chunk it wants to fill next. Stops after
+ * handing over the last partial chunk at end of input.
+ */
+void *trace_reader_run(void *arg) {
+	trace_reader_t *r = arg;
+	int i = 0;
+
+	while (1) {
+		pthread_mutex_lock(&r->lock);
+		while (r->chunk_full[i] && !r->stop) {
+			pthread_cond_wait(&r->cond, &r->lock);
+		}
+		int stop = r->stop;
+		pthread_mutex_unlock(&r->lock);
+		if (stop) break;
+
+		size_t len = 0;
+		ssize_t got = 1;
+		while (len < TRACE_CHUNK && got != 0) {
+			got = read(r->fd, r->chunks[i] + len, TRACE_CHUNK - len);
+			if (got < 0) {
+				if (errno == EINTR) continue;
+				fprintf(stderr, "%s: %s\n", r->name, strerror(errno));
+				exit(1);
+			}
+			len += got;
+		}
+
+		pthread_mutex_lock(&r->lock);
+		if (len > 0) {
+			r->chunk_len[i] = len;
+			r->chunk_full[i] = 1;
+		}
+		if (got == 0) {
+			r->eof = 1;
+		}
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+
+		if (got == 0) break;
+		i ^= 1;
+	}
+	return NULL;
+}
+
+/*
+ * trace_open:
+ * Opens the trace for reading, "-" meaning standard input, and starts its
+ * reader thread. Exits with an error if the trace can't be opened.
+ */
+trace_reader_t *trace_open(char *trace_fn) {
+	trace_reader_t *r = calloc(1, sizeof(trace_reader_t));
+	if (r == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	r->name = trace_fn;
+	r->fd = strcmp(trace_fn, "-") == 0 ? STDIN_FILENO : open(trace_fn, O_RDONLY);
+	if (r->fd < 0) {
+		fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+		exit(1);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		r->chunks[i] = malloc(TRACE_CHUNK);
+		if (r->chunks[i] == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+	}
+	r->cur = -1;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	if (pthread_create(&r->thread, NULL, trace_reader_run, r) != 0) {
+		fprintf(stderr, "Error: pthread_create failed\n");
+		exit(1);
+	}
+	return r;
+}
+
+/*
+ * trace_close:
+ * Stops the reader thread and frees the reader.
+ */
+void trace_close(trace_reader_t *r) {
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	if (r->fd != STDIN_FILENO) {
+		close(r->fd);
+	}
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r->chunks[0]);
+	free(r->chunks[1]);
+	free(r);
+}
+
+/*
+ * trace_next_chunk:
+ * Hands the chunk being parsed back to the reader thread and waits for
+ * the next one. Returns 0 once the input is used up.
+ */
+int trace_next_chunk(trace_reader_t *r) {
+	pthread_mutex_lock(&r->lock);
+	if (r->cur >= 0) {
+		r->chunk_full[r->cur] = 0;
+		r->cur = -1;
+		pthread_cond_broadcast(&r->cond);
+	}
+	while (!r->chunk_full[r->next] && !r->eof) {
+		pthread_cond_wait(&r->cond, &r->lock);
+	}
+	if (!r->chunk_full[r->next]) {
+		pthread_mutex_unlock(&r->lock);
+		return 0;
+	}
+	r->cur = r->next;
+	r->next ^= 1;
+	r->data = r->chunks[r->cur];
+	r->len = r->chunk_len[r->cur];
+	r->pos = 0;
+	pthread_mutex_unlock(&r->lock);
+	return 1;
+}
+
+/*
+ * trace_carry:
+ * Appends part of a line that continues in the next chunk to the carry
+ * buffer. Like fgets, overlong lines are cut at TRACE_LINE - 1 characters.
+ */
+static void trace_carry(trace_reader_t *r, const char *part, size_t len) {
+	size_t room = TRACE_LINE - 1 - r->carry_len;
+	if (len > room) len = room;
+	memcpy(r->carry + r->carry_len, part, len);
+	r->carry_len += len;
+}
+
+/*
+ * trace_next_line:
+ * Returns the next line of the trace without its newline, or NULL at the
+ * end. The line stays valid until the next call.
+ */
+char *trace_next_line(trace_reader_t *r) {
+	while (1) {
+		if (r->pos < r->len) {
+			char *start = r->data + r->pos;
+			char *nl = memchr(start, '\n', r->len - r->pos);
+
+			if (nl != NULL) {
+				*nl = '\0';
+				r->pos = nl - r->data + 1;
+				if (r->carry_len == 0) {
+					return start;
+				}
+				trace_carry(r, start, nl - start);
+				r->carry[r->carry_len] = '\0';
+				r->carry_len = 0;
+				return r->carry;
+			}
+
+			// the line continues in the next chunk
+			trace_carry(r, start, r->len - r->pos);
+			r->pos = r->len;
+		}
+
+		if (!trace_next_chunk(r)) {
+			if (r->carry_len == 0) {
+				return NULL;
+			}
+			// last line without a newline
+			r->carry[r->carry_len] = '\0';
+			r->carry_len = 0;
+			return r->carry;
+		}
+	}
+}
+
+/*
+ * read_trace_batch:
+ * Decodes up to "max" data accesses from the trace into "batch".
+ * Returns the number decoded, 0 at the end of the trace.
+ */
+int read_trace_batch(trace_reader_t *trace, trace_access_t *batch, int max) {
+	char *line;
+	int n = 0;
+
+	while (n < max && (line = trace_next_line(trace)) != NULL) {
+		if (line[0] == 'I') {
+			const char *p = line + 3;
+			trace->pc = parse_hex(&p);
+		} else if (parse_trace_line(line, &batch[n])) {
+			batch[n++].pc = trace->pc;
+		}
+	}
+	return n;
+}
+
+//Type split_buf_t: Scratch space that split_batch() grows as needed.
+typedef struct split_buf {
+	trace_access_t *accs;
+	long long cap;
+} split_buf_t;
+
+/*
+ * split_batch:
+ * With -l, cuts every access in "batch" at 2^b byte block boundaries, so an
+ * access covering k blocks becomes k accesses of the same type, PC and
+ * core, each with the length that falls in its block and all but the first
+ * marked "cont". Updates "*n" and returns the split
+ * accesses, which live in "buf" if anything was cut.
+ *
+ * Batches in which no access crosses a block, the common case, are found
+ * with one branch-free scan and returned as they are.
+ */
+trace_access_t *split_batch(trace_access_t *batch, int *n, int b, split_buf_t *buf) {
+	if (!split_blocks) {
+		return batch;
+	}
+
+	mem_addr_t crossing = 0;
+	for (int i = 0; i < *n; i++) {
+		mem_addr_t last = batch[i].addr + (batch[i].len ? batch[i].len - 1 : 0);
+		crossing |= (batch[i].addr ^ last) >> b;
+	}
+	if (crossing == 0) {
+		return batch;
+	}
+
+	long long total = 0;
+	for (int i = 0; i < *n; i++) {
+		mem_addr_t last = batch[i].addr + (batch[i].len ? batch[i].len - 1 : 0);
+		total += (last >> b) - (batch[i].addr >> b) + 1;
+	}
+	if (total > buf->cap) {
+		buf->cap = total * 2;
+		buf->accs = realloc(buf->accs, sizeof(trace_access_t) * buf->cap);
+		if (buf->accs == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+	}
+
+	long long k = 0;
+	for (int i = 0; i < *n; i++) {
+		mem_addr_t addr = batch[i].addr;
+		mem_addr_t end = addr + (batch[i].len ? batch[i].len : 1);
+		do {
+			mem_addr_t block_end = ((addr >> b) + 1) << b;
+			mem_addr_t piece_end = block_end < end ? block_end : end;
+			buf->accs[k] = batch[i];
+			buf->accs[k].addr = addr;
+			buf->accs[k].len = piece_end - addr;
+			buf->accs[k].cont = addr != batch[i].addr;
+			k++;
+			addr = piece_end;
+		} while (addr < end);
+	}
+	*n = k;
+	return buf->accs;
+}
+
+/* TODO - FILL IN THE MISSING CODE
+ * replay_trace:
+ * Replays the given trace file against the cache.
+ *
+ * Reads the input trace file line by line.
+ * Extracts the type of each memory access : L/S/M
+ * TRANSLATE each "L" as a load i.e. 1 memory access
+ * TRANSLATE each "S" as a store i.e. 1 memory access
+ * TRANSLATE each "M" as a load followed by a store i.e. 2 memory accesses
+ */
+void replay_trace(char* trace_fn) {
+        char* buf;
+        trace_access_t acc;
+        split_buf_t split = { NULL, 0 };
+        trace_reader_t* trace = trace_open(trace_fn);
+
+        while ((buf = trace_next_line(trace)) != NULL) {
+                if (buf[0] == 'I') {
+                        // remember the instruction for miss attribution
+                        const char *p = buf + 3;
+                        current_pc = parse_hex(&p);
+                } else if (parse_trace_line(buf, &acc)) {
+                        if (verbosity)
+                                printf("%c %llx,%u ", acc.op, acc.addr, acc.len);
+
+                        // with -l, one access per block the access covers
+                        int n = 1;
+                        trace_access_t *pieces = split_batch(&acc, &n, b, &split);
+
+                        // TODO - MISSING CODE
+                        // GIVEN: 1. addr has the address to be accessed
+                        //        2. buf[1] has type of acccess(S/L/M)
+                        // call access_data function here depending on type of access
+                        for (int i = 0; i < n; i++) {
+                                trace_access_t *p = &pieces[i];
+                                current_cont = p->cont;
+                                if (p->op == 'S') {
+                                        access_data_rw(p->addr, 1, p->len);
+                                } else if (p->op == 'L') {
+                                        access_data(p->addr);
+                                } else if (p->op == 'M') {
+                                        access_data(p->addr);
+                                        access_data_rw(p->addr, 1, p->len);
+                                }
+                        }
+
+                        if (verbosity)
+                                printf("\n");
+                }
+        }
+
+        trace_close(trace);
+        free(split.accs);
+}
+
+
+/******************************************************************************/
+/* Sweep mode *****************************************************************/
+
+//Number of decoded accesses handed to the sweep workers at a time.
+#define SWEEP_BATCH 65536
+
+//Type sweep_t: State shared by the trace reader and the sweep workers.
+//The reader decodes into one of two buffers while the workers replay the
+//other; a barrier separates the rounds.
+typedef struct sweep {
+	cache_sim_t *sims;
+	int num_sims;
+	int num_threads;
+	trace_access_t *batch[2];
+	int count[2];
+	pthread_barrier_t barrier;
+} sweep_t;
+
+//Type sweep_worker_t: One sweep worker and the configurations it owns.
+typedef struct sweep_worker {
+	sweep_t *sweep;
+	int id;
+} sweep_worker_t;
+
+/*
+ * sweep_parse_range:
+ * Parses one field of a sweep configuration: "N" or "lo-hi".
+ * E ranges double at each step (1-8 is 1,2,4,8), s and b ranges count by one.
+ * Returns the number of values written to "vals", or -1 on a bad field.
+ */
+int sweep_parse_range(char *field, int doubling, int *vals, int max) {
+	char *end;
+	long lo = strtol(field, &end, 10);
+	long hi = lo;
+
+	if (end == field) return -1;
+	if (*end == '-') {
+		char *hi_str = end + 1;
+		hi = strtol(hi_str, &end, 10);
+		if (end == hi_str) return -1;
+	}
+	if (*end != '\0' || lo < 0 || hi < lo) return -1;
+
+	int n = 0;
+	for (long v = lo; v <= hi && n < max; v = doubling ? v * 2 : v + 1) {
+		vals[n++] = v;
+		if (doubling && v == 0) break; //doubling would never leave 0
+	}
+	return n;
+}
+
+/*
+ * sweep_parse:
+ * Builds the list of caches described by "spec", a comma separated list of
+ * s:E:b configurations whose fields may be ranges, e.g. "4:1:4,2-8:1-16:4-6".
+ * Exits with an error on a malformed spec.
+ */
+void sweep_parse(char *spec, sweep_t *sw) {
+	char *copy = strdup(spec);
+	char *save = NULL;
+	int cap = 16;
+
+	sw->sims = malloc(sizeof(cache_sim_t) * cap);
+	sw->num_sims = 0;
+	if (copy == NULL || sw->sims == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	for (char *item = strtok_r(copy, ",", &save); item != NULL;
+			item = strtok_r(NULL, ",", &save)) {
+		char *fields[3];
+		int vals[3][64];
+		int nvals[3];
+
+		fields[0] = item;
+		fields[1] = strchr(item, ':');
+		fields[2] = fields[1] ? strchr(fields[1] + 1, ':') : NULL;
+		if (fields[2] == NULL) {
+			fprintf(stderr, "Bad sweep configuration \"%s\", expected s:E:b\n", item);
+			exit(1);
+		}
+		*fields[1]++ = '\0';
+		*fields[2]++ = '\0';
+
+		for (int f = 0; f < 3; f++) {
+			nvals[f] = sweep_parse_range(fields[f], f == 1, vals[f], 64);
+			if (nvals[f] <= 0) {
+				fprintf(stderr, "Bad sweep field \"%s\"\n", fields[f]);
+				exit(1);
+			}
+		}
+
+		for (int i = 0; i < nvals[0]; i++) {
+			for (int j = 0; j < nvals[1]; j++) {
+				for (int k = 0; k < nvals[2]; k++) {
+					if (vals[1][j] == 0 || vals[0][i] + vals[2][k] >= 64) {
+						fprintf(stderr, "Bad sweep configuration %d:%d:%d\n",
+								vals[0][i], vals[1][j], vals[2][k]);
+						exit(1);
+					}
+					if (sw->num_sims == cap) {
+						cap *= 2;
+						sw->sims = realloc(sw->sims, sizeof(cache_sim_t) * cap);
+						if (sw->sims == NULL) {
+							printf("Error: malloc failed");
+							exit(1);
+						}
+					}
+					cache_init(&sw->sims[sw->num_sims++], vals[0][i], vals[1][j], vals[2][k]);
+				}
+			}
+		}
+	}
+
+	free(copy);
+}
+
+/*
+ * sweep_worker:
+ * Thread body: replays every batch against the configurations whose index
+ * is congruent to the worker id, until the reader posts an empty batch.
+ */
+void *sweep_worker(void *arg) {
+	sweep_worker_t *w = arg;
+	sweep_t *sw = w->sweep;
+	split_buf_t split = { NULL, 0 };
+	int cur = 0;
+
+	while (1) {
+		pthread_barrier_wait(&sw->barrier);
+		int n = sw->count[cur];
+		if (n == 0) break;
+
+		for (int c = w->id; c < sw->num_sims; c += sw->num_threads) {
+			cache_sim_t *sim = &sw->sims[c];
+			int num = n;
+			trace_access_t *batch = split_batch(sw->batch[cur], &num, sim->b, &split);
+			for (int i = 0; i < num; i++) {
+				cache_replay(sim, &batch[i]);
+			}
+		}
+		cur ^= 1;
+	}
+	free(split.accs);
+	return NULL;
+}
+
+/*
+ * sweep_print:
+ * Prints one row per configuration with its counters and miss rate.
+ */
+void sweep_print(sweep_t *sw) {
+	printf("%3s %5s %3s %12s %14s %14s %14s %9s\n",
+			"s", "E", "b", "size", "hits", "misses", "evictions", "miss_rate");
+	for (int c = 0; c < sw->num_sims; c++) {
+		cache_sim_t *sim = &sw->sims[c];
+		long long accesses = sim->hits + sim->misses;
+		printf("%3d %5d %3d %12lld %14lld %14lld %14lld %9.6f\n",
+				sim->s, sim->E, sim->b, (long long) sim->S * sim->E * sim->B,
+				sim->hits, sim->misses, sim->evictions,
+				accesses ? (double) sim->misses / accesses : 0.0);
+	}
+}
+
+/*
+ * sweep_trace:
+ * Decodes the trace once and replays it against every configuration in
+ * "spec" using up to "num_threads" worker threads, then prints the table.
+ */
+void sweep_trace(char *trace_fn, char *spec, int num_threads) {
+	sweep_t sw;
+	sweep_parse(spec, &sw);
+
+	if (num_threads <= 0) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (num_threads > sw.num_sims) num_threads = sw.num_sims;
+	if (num_threads < 1) num_threads = 1;
+	sw.num_threads = num_threads;
+
+	for (int i = 0; i < 2; i++) {
+		sw.batch[i] = malloc(sizeof(trace_access_t) * SWEEP_BATCH);
+		if (sw.batch[i] == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+	}
+	pthread_barrier_init(&sw.barrier, NULL, num_threads + 1);
+
+	pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+	sweep_worker_t *workers = malloc(sizeof(sweep_worker_t) * num_threads);
+	if (threads == NULL || workers == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	for (int i = 0; i < num_threads; i++) {
+		workers[i].sweep = &sw;
+		workers[i].id = i;
+		if (pthread_create(&threads[i], NULL, sweep_worker, &workers[i]) != 0) {
+			fprintf(stderr, "Error: pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	// decode the next batch while the workers replay the previous one
+	trace_reader_t *trace = trace_open(trace_fn);
+	int cur = 0;
+	int n;
+	do {
+		n = read_trace_batch(trace, sw.batch[cur], SWEEP_BATCH);
+		sw.count[cur] = n;
+		pthread_barrier_wait(&sw.barrier);
+		cur ^= 1;
+	} while (n > 0);
+	trace_close(trace);
+
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	sweep_print(&sw);
+
+	for (int c = 0; c < sw.num_sims; c++) {
+		cache_free(&sw.sims[c]);
+	}
+	pthread_barrier_destroy(&sw.barrier);
+	free(sw.sims);
+	free(sw.batch[0]);
+	free(sw.batch[1]);
+	free(threads);
+	free(workers);
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Parallel mode **************************************************************/
+
+//Slots in each worker's ring; a power of 2.
+#define RING_SIZE 16384
+//The producer publishes its tail after this many pushes.
+#define RING_PUBLISH 256
+
+//Type spsc_ring_t: Lock-free single producer, single consumer queue of
+//decoded accesses. Each side keeps a private copy of the other side's index and
+//only reloads it when the ring looks full (producer) or empty (consumer).
+typedef struct spsc_ring {
+	_Atomic unsigned long long head; //next slot the consumer reads
+	char pad0[64 - sizeof(unsigned long long)];
+	_Atomic unsigned long long tail; //next slot the producer publishes
+	_Atomic int done;                //producer has published everything
+	char pad1[64 - sizeof(unsigned long long) - sizeof(int)];
+	unsigned long long prod_tail;    //producer's unpublished tail
+	unsigned long long prod_head;    //producer's copy of head
+	char pad2[64 - 2 * sizeof(unsigned long long)];
+	trace_access_t slots[RING_SIZE];
+} spsc_ring_t;
+
+//Type set_worker_t: A worker that owns every set whose index is congruent
+//to its id. It shares the line arrays of the main cache but has its own
+//stamp and counters.
+typedef struct set_worker {
+	spsc_ring_t ring;
+	cache_sim_t sim;
+	pthread_t thread;
+} set_worker_t;
+
+/*
+ * ring_publish:
+ * Makes the producer's pushes visible to the consumer.
+ */
+static inline void ring_publish(spsc_ring_t *r) {
+	atomic_store_explicit(&r->tail, r->prod_tail, memory_order_release);
+}
+
+/*
+ * ring_push:
+ * Producer side: appends "acc", waiting while the ring is full.
+ */
+static inline void ring_push(spsc_ring_t *r, const trace_access_t *acc) {
+	if (r->prod_tail - r->prod_head == RING_SIZE) {
+		ring_publish(r);
+		while ((r->prod_head = atomic_load_explicit(&r->head, memory_order_acquire))
+				== r->prod_tail - RING_SIZE) {
+			sched_yield();
+		}
+	}
+	r->slots[r->prod_tail & (RING_SIZE - 1)] = *acc;
+	r->prod_tail++;
+	if ((r->prod_tail & (RING_PUBLISH - 1)) == 0) {
+		ring_publish(r);
+	}
+}
+
+/*
+ * set_worker_run:
+ * Consumer side: replays the accesses from the ring against the worker's
+ * sets until the producer is done and the ring is drained.
+ */
+void *set_worker_run(void *arg) {
+	set_worker_t *w = arg;
+	spsc_ring_t *r = &w->ring;
+	unsigned long long head = 0;
+
+	while (1) {
+		unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+		if (head == tail) {
+			if (atomic_load_explicit(&r->done, memory_order_acquire)
+					&& head == atomic_load_explicit(&r->tail, memory_order_acquire)) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+
+		for (; head != tail; head++) {
+			cache_replay(&w->sim, &r->slots[head & (RING_SIZE - 1)]);
+		}
+		atomic_store_explicit(&r->head, head, memory_order_release);
+	}
+	return NULL;
+}
+
+/*
+ * replay_trace_parallel:
+ * Replays the trace against the cache with "num_threads" workers, each
+ * owning the sets congruent to its id. The caller decodes the trace and
+ * routes every access to its set's owner, so each set still sees its
+ * accesses in trace order and the counters equal those of replay_trace().
+ */
+void replay_trace_parallel(char *trace_fn, int num_threads) {
+	set_worker_t *workers = NULL;
+	trace_access_t *batch = malloc(sizeof(trace_access_t) * SWEEP_BATCH);
+	if (posix_memalign((void **) &workers, 64, sizeof(set_worker_t) * num_threads) != 0
+			|| batch == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		set_worker_t *w = &workers[i];
+		atomic_init(&w->ring.head, 0);
+		atomic_init(&w->ring.tail, 0);
+		atomic_init(&w->ring.done, 0);
+		w->ring.prod_tail = 0;
+		w->ring.prod_head = 0;
+		w->sim = sim;
+		w->sim.hits = w->sim.misses = w->sim.evictions = 0;
+		w->sim.writebacks = w->sim.mem_read_bytes = w->sim.mem_write_bytes = 0;
+		if (pthread_create(&w->thread, NULL, set_worker_run, w) != 0) {
+			fprintf(stderr, "Error: pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	trace_reader_t *trace = trace_open(trace_fn);
+	split_buf_t split = { NULL, 0 };
+	int n;
+	while ((n = read_trace_batch(trace, batch, SWEEP_BATCH)) > 0) {
+		trace_access_t *accs = split_batch(batch, &n, b, &split);
+		for (int i = 0; i < n; i++) {
+			mem_addr_t addr = accs[i].addr;
+			ring_push(&workers[((addr >> b) & (S - 1)) % num_threads].ring, &accs[i]);
+		}
+	}
+	trace_close(trace);
+	free(split.accs);
+
+	// merge the per-worker counters into the global ones
+	for (int i = 0; i < num_threads; i++) {
+		ring_publish(&workers[i].ring);
+		atomic_store_explicit(&workers[i].ring.done, 1, memory_order_release);
+	}
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		hit_cnt += workers[i].sim.hits;
+		miss_cnt += workers[i].sim.misses;
+		evict_cnt += workers[i].sim.evictions;
+		sim.writebacks += workers[i].sim.writebacks;
+		sim.mem_read_bytes += workers[i].sim.mem_read_bytes;
+		sim.mem_write_bytes += workers[i].sim.mem_write_bytes;
+	}
+
+	free(workers);
+	free(batch);
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Stack distance mode ********************************************************/
+
+//Type stack_dist_t: Mattson stack distance analysis for one block size.
+//
+//Every access is stamped with a time. "last" maps each block to the time of
+//its most recent access, and the Fenwick tree "marks" has a 1 at exactly
+//those times. The stack distance of an access is then the number of marks
+//between the block's previous time and now, i.e. the number of distinct
+//blocks touched in between, found in O(log n). When the times run out the
+//live marks are renumbered 1..k, so the tree only grows with the number of
+//distinct blocks, not with the trace length.
+typedef struct stack_dist {
+	int b;
+	addr_map_t last;
+	int *marks;            //Fenwick tree over times 1..size
+	long long size;        //number of times in the tree, a power of 2
+	long long now;         //time of the next access
+	long long *hist;       //hist[d]: accesses with stack distance d
+	long long hist_size;
+	long long cold;        //first touches, a miss at every capacity
+	long long accesses;
+} stack_dist_t;
+
+/*
+ * fenwick_add:
+ * Adds "delta" at time "t" of a Fenwick tree with "size" slots.
+ */
+static inline void fenwick_add(int *tree, long long size, long long t, int delta) {
+	for (; t <= size; t += t & -t) {
+		tree[t] += delta;
+	}
+}
+
+/*
+ * fenwick_sum:
+ * Returns the sum of times 1..t of a Fenwick tree.
+ */
+static inline long long fenwick_sum(int *tree, long long t) {
+	long long sum = 0;
+	for (; t > 0; t -= t & -t) {
+		sum += tree[t];
+	}
+	return sum;
+}
+
+/*
+ * stack_dist_init:
+ * Sets up an empty analysis for 2^b byte blocks.
+ */
+void stack_dist_init(stack_dist_t *sd, int b) {
+	memset(sd, 0, sizeof(*sd));
+	sd->b = b;
+	sd->size = 1 << 16;
+	sd->now = 1;
+	sd->marks = calloc(sd->size + 1, sizeof(int));
+	sd->hist_size = 1024;
+	sd->hist = calloc(sd->hist_size, sizeof(long long));
+	if (sd->marks == NULL || sd->hist == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	addr_map_init(&sd->last, 1 << 16);
+}
+
+/*
+ * stack_dist_compact:
+ * Renumbers the live marks to times 1..k in their original order, doubling
+ * the tree first if it would still be more than half full.
+ */
+void stack_dist_compact(stack_dist_t *sd) {
+	long long live = sd->last.count;
+
+	// a block's new time is its rank among the live marks
+	for (unsigned long long i = 0; i <= sd->last.mask; i++) {
+		addr_map_entry_t *e = &sd->last.slots[i];
+		if (e->key != ADDR_MAP_EMPTY) {
+			e->value = fenwick_sum(sd->marks, e->value);
+		}
+	}
+
+	if (live * 2 > sd->size) {
+		free(sd->marks);
+		sd->size *= 2;
+		sd->marks = malloc(sizeof(int) * (sd->size + 1));
+		if (sd->marks == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+	}
+
+	// build the tree with marks at 1..live in linear time
+	memset(sd->marks, 0, sizeof(int) * (sd->size + 1));
+	for (long long t = 1; t <= sd->size; t++) {
+		if (t <= live) sd->marks[t] += 1;
+		long long parent = t + (t & -t);
+		if (parent <= sd->size) sd->marks[parent] += sd->marks[t];
+	}
+	sd->now = live + 1;
+}
+
+/*
+ * stack_dist_access:
+ * Records one access to "addr" in the histogram.
+ */
+void stack_dist_access(stack_dist_t *sd, mem_addr_t addr) {
+	if (sd->now > sd->size) {
+		stack_dist_compact(sd);
+	}
+
+	long long now = sd->now++;
+	int added;
+	addr_map_entry_t *e = addr_map_insert(&sd->last, addr >> sd->b, now, &added);
+
+	sd->accesses++;
+	fenwick_add(sd->marks, sd->size, now, 1);
+	if (added) {
+		sd->cold++;
+		return;
+	}
+
+	// distinct blocks touched since this block's last access
+	long long prev = e->value;
+	long long dist = fenwick_sum(sd->marks, now - 1) - fenwick_sum(sd->marks, prev);
+	fenwick_add(sd->marks, sd->size, prev, -1);
+	e->value = now;
+
+	if (dist >= sd->hist_size) {
+		long long new_size = sd->hist_size;
+		while (new_size <= dist) new_size *= 2;
+		sd->hist = realloc(sd->hist, sizeof(long long) * new_size);
+		if (sd->hist == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+		memset(sd->hist + sd->hist_size, 0, sizeof(long long) * (new_size - sd->hist_size));
+		sd->hist_size = new_size;
+	}
+	sd->hist[dist]++;
+}
+
+/*
+ * stack_dist_print:
+ * Prints the miss ratio curve of a fully associative LRU cache: the misses
+ * at capacity C are the cold misses plus the accesses with distance >= C.
+ * Capacities are powers of 2 up to the number of distinct blocks; with -v
+ * every capacity where the curve changes is printed as well.
+ */
+void stack_dist_print(stack_dist_t *sd) {
+	long long distinct = sd->cold;
+	long long misses = sd->accesses;
+	long long next_pow2 = 1;
+
+	printf("b:%d B:%d accesses:%lld distinct_blocks:%lld\n",
+			sd->b, 1 << sd->b, sd->accesses, distinct);
+	printf("%14s %16s %14s %9s\n", "lines", "bytes", "misses", "miss_rate");
+
+	// misses at capacity C = accesses - sum(hist[0..C-1])
+	for (long long cap = 1; cap <= distinct; cap++) {
+		long long hits_at = cap - 1 < sd->hist_size ? sd->hist[cap - 1] : 0;
+		misses -= hits_at;
+
+		if (cap == next_pow2 || cap == distinct || (verbosity && hits_at != 0)) {
+			printf("%14lld %16lld %14lld %9.6f\n", cap, cap << sd->b, misses,
+					sd->accesses ? (double) misses / sd->accesses : 0.0);
+		}
+		if (cap == next_pow2) next_pow2 *= 2;
+	}
+	printf("\n");
+}
+
+/*
+ * stack_dist_trace:
+ * Computes the stack distance histogram of the trace for every block size
+ * listed in "spec" (comma separated b values or lo-hi ranges) in one pass,
+ * then prints a miss ratio curve per block size.
+ */
+void stack_dist_trace(char *trace_fn, char *spec) {
+	int bs[64];
+	int num_bs = 0;
+	char *copy = strdup(spec);
+	char *save = NULL;
+
+	for (char *item = strtok_r(copy, ",", &save); item != NULL;
+			item = strtok_r(NULL, ",", &save)) {
+		int n = sweep_parse_range(item, 0, bs + num_bs, 64 - num_bs);
+		if (n <= 0) {
+			fprintf(stderr, "Bad block size list \"%s\"\n", spec);
+			exit(1);
+		}
+		num_bs += n;
+	}
+	free(copy);
+
+	stack_dist_t *sds = malloc(sizeof(stack_dist_t) * num_bs);
+	trace_access_t *batch = malloc(sizeof(trace_access_t) * SWEEP_BATCH);
+	if (sds == NULL || batch == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	for (int i = 0; i < num_bs; i++) {
+		stack_dist_init(&sds[i], bs[i]);
+	}
+
+	trace_reader_t *trace = trace_open(trace_fn);
+	split_buf_t split = { NULL, 0 };
+	int n;
+	while ((n = read_trace_batch(trace, batch, SWEEP_BATCH)) > 0) {
+		for (int i = 0; i < num_bs; i++) {
+			int num = n;
+			trace_access_t *accs = split_batch(batch, &num, sds[i].b, &split);
+			for (int j = 0; j < num; j++) {
+				stack_dist_access(&sds[i], accs[j].addr);
+				if (accs[j].op == 'M') {
+					stack_dist_access(&sds[i], accs[j].addr);
+				}
+			}
+		}
+	}
+	trace_close(trace);
+	free(split.accs);
+
+	for (int i = 0; i < num_bs; i++) {
+		stack_dist_print(&sds[i]);
+		addr_map_free(&sds[i].last);
+		free(sds[i].marks);
+		free(sds[i].hist);
+	}
+	free(sds);
+	free(batch);
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Hierarchy mode *************************************************************/
+
+//Most cache levels in a hierarchy.
+#define MAX_LEVELS 4
+
+//How the contents of neighbouring levels relate, selected with -I.
+#define INCLUSION_NINE      0 //non-inclusive non-exclusive
+#define INCLUSION_INCLUSIVE 1 //a lower level holds everything above it
+#define INCLUSION_EXCLUSIVE 2 //a block lives in at most one level
+
+const char *inclusion_names[] = { "nine", "inclusive", "exclusive" };
+
+//Type hierarchy_t: Cache levels from L1 (level 0) down to the last level,
+//all write-back and write-allocate, in front of memory.
+typedef struct hierarchy {
+	cache_sim_t levels[MAX_LEVELS];
+	int num_levels;
+	int inclusion;
+	long long back_invalidations[MAX_LEVELS]; //lines removed to keep inclusion
+	long long mem_reads;  //blocks fetched from memory
+	long long mem_writes; //dirty blocks written to memory
+} hierarchy_t;
+
+void hier_fill(hierarchy_t *h, int level, mem_addr_t addr, int dirty, int prefetched);
+int hier_fetch(hierarchy_t *h, int level, mem_addr_t addr);
+
+/*
+ * hier_writeback:
+ * Delivers a dirty block evicted from the level above "level" to it, or to
+ * memory below the last level. A block missing from the level is
+ * allocated there dirty.
+ */
+void hier_writeback(hierarchy_t *h, int level, mem_addr_t addr) {
+	if (level == h->num_levels) {
+		h->mem_writes++;
+		return;
+	}
+
+	cache_line_t *line = cache_probe(&h->levels[level], addr, 0);
+	if (line != NULL) {
+		line->dirty = 1;
+	} else {
+		hier_fill(h, level, addr, 1, 0);
+	}
+}
+
+/*
+ * hier_fill:
+ * Installs the block of "addr" in "level" and deals with the victim:
+ * inclusive hierarchies first pull it out of the levels above, exclusive
+ * ones move it one level down, and dirty victims are written back.
+ */
+void hier_fill(hierarchy_t *h, int level, mem_addr_t addr, int dirty, int prefetched) {
+	mem_addr_t victim;
+	int victim_dirty;
+
+	if (!cache_install(&h->levels[level], addr, dirty, prefetched, &victim, &victim_dirty)) {
+		return;
+	}
+
+	if (h->inclusion == INCLUSION_INCLUSIVE) {
+		for (int i = 0; i < level; i++) {
+			int upper_dirty;
+			if (cache_remove(&h->levels[i], victim, &upper_dirty)) {
+				h->back_invalidations[i]++;
+				victim_dirty |= upper_dirty;
+			}
+		}
+	}
+
+	if (victim_dirty) {
+		h->levels[level].writebacks++;
+	}
+	if (h->inclusion == INCLUSION_EXCLUSIVE && level + 1 < h->num_levels) {
+		hier_fill(h, level + 1, victim, victim_dirty, 0);
+	} else if (victim_dirty) {
+		hier_writeback(h, level + 1, victim);
+	}
+}
+
+/*
+ * hier_prefetch:
+ * Brings the block of "addr" into "level" for its prefetcher unless it's
+ * already there. The request goes down like a demand miss.
+ */
+void hier_prefetch(hierarchy_t *h, int level, mem_addr_t addr) {
+	cache_sim_t *c = &h->levels[level];
+
+	if (cache_probe(c, addr, 0) != NULL) {
+		return;
+	}
+	c->pf->issued++;
+	int dirty = hier_fetch(h, level + 1, addr);
+	hier_fill(h, level, addr, dirty, 1);
+}
+
+/*
+ * hier_observe:
+ * Shows a demand access at "level" to the level's prefetcher, if any, and
+ * issues the prefetches it asks for.
+ */
+void hier_observe(hierarchy_t *h, int level, mem_addr_t addr, int event) {
+	cache_sim_t *c = &h->levels[level];
+	mem_addr_t targets[MAX_PREFETCH_DEGREE];
+
+	if (c->pf == NULL) {
+		return;
+	}
+	int n = prefetch_observe(c->pf, c->b, addr, event, targets);
+	for (int i = 0; i < n; i++) {
+		hier_prefetch(h, level, targets[i]);
+	}
+}
+
+/*
+ * hier_hit_event:
+ * Returns the prefetch event for a demand hit on "line", clearing its
+ * prefetched mark.
+ */
+static inline int hier_hit_event(cache_line_t *line) {
+	if (line->prefetched) {
+		line->prefetched = 0;
+		return PF_PREFETCHED_HIT;
+	}
+	return PF_HIT;
+}
+
+/*
+ * hier_fetch:
+ * Serves a miss from the level above "level". Returns the dirty bit the
+ * block carries up, which is only ever set when an exclusive level hands
+ * over its copy.
+ */
+int hier_fetch(hierarchy_t *h, int level, mem_addr_t addr) {
+	if (level == h->num_levels) {
+		h->mem_reads++;
+		return 0;
+	}
+
+	cache_sim_t *c = &h->levels[level];
+	if (h->inclusion == INCLUSION_EXCLUSIVE) {
+		int dirty;
+		cache_line_t *line = cache_probe(c, addr, 0);
+		int event = line != NULL ? hier_hit_event(line) : PF_MISS;
+		if (cache_remove(c, addr, &dirty)) {
+			c->hits++;
+			hier_observe(h, level, addr, event);
+			return dirty;
+		}
+		c->misses++;
+		dirty = hier_fetch(h, level + 1, addr);
+		hier_observe(h, level, addr, PF_MISS);
+		return dirty;
+	}
+
+	cache_line_t *line = cache_probe(c, addr, 1);
+	if (line != NULL) {
+		c->hits++;
+		hier_observe(h, level, addr, hier_hit_event(line));
+		return 0;
+	}
+	c->misses++;
+	hier_fetch(h, level + 1, addr);
+	hier_fill(h, level, addr, 0, 0);
+	hier_observe(h, level, addr, PF_MISS);
+	return 0;
+}
+
+/*
+ * hier_access:
+ * Simulates one load (write = 0) or store (write = 1) at the first level.
+ * Stores allocate on a miss and mark the line dirty.
+ */
+void hier_access(hierarchy_t *h, mem_addr_t addr, int write) {
+	cache_sim_t *l1 = &h->levels[0];
+	cache_line_t *line = cache_probe(l1, addr, 1);
+
+	if (line != NULL) {
+		l1->hits++;
+		line->dirty |= write;
+		hier_observe(h, 0, addr, hier_hit_event(line));
+		return;
+	}
+
+	l1->misses++;
+	int dirty = hier_fetch(h, 1, addr);
+	hier_fill(h, 0, addr, dirty | write, 0);
+	hier_observe(h, 0, addr, PF_MISS);
+}
+
+/*
+ * hier_parse:
+ * Builds the levels described by "spec", a comma separated list of s:E:b
+ * configurations from L1 down. All levels must use the same block size.
+ */
+void hier_parse(char *spec, hierarchy_t *h) {
+	char *copy = strdup(spec);
+	char *save = NULL;
+
+	h->num_levels = 0;
+	for (char *item = strtok_r(copy, ",", &save); item != NULL;
+			item = strtok_r(NULL, ",", &save)) {
+		int ls, lE, lb;
+		char extra;
+		if (sscanf(item, "%d:%d:%d%c", &ls, &lE, &lb, &extra) != 3
+				|| ls < 0 || lE <= 0 || lb < 0 || ls + lb >= 64) {
+			fprintf(stderr, "Bad cache level \"%s\", expected s:E:b\n", item);
+			exit(1);
+		}
+		if (h->num_levels == MAX_LEVELS) {
+			fprintf(stderr, "At most %d cache levels are supported\n", MAX_LEVELS);
+			exit(1);
+		}
+		if (h->num_levels > 0 && lb != h->levels[0].b) {
+			fprintf(stderr, "All cache levels must use the same block size\n");
+			exit(1);
+		}
+		cache_init(&h->levels[h->num_levels++], ls, lE, lb);
+	}
+	free(copy);
+
+	if (h->num_levels == 0) {
+		fprintf(stderr, "Bad hierarchy \"%s\"\n", spec);
+		exit(1);
+	}
+}
+
+/*
+ * hier_trace:
+ * Replays the trace against the hierarchy in "spec" and prints the
+ * counters of every level and the memory traffic.
+ */
+void hier_trace(char *trace_fn, char *spec, int inclusion, char *prefetch_spec) {
+	hierarchy_t h;
+	memset(&h, 0, sizeof(h));
+	h.inclusion = inclusion;
+	hier_parse(spec, &h);
+	if (prefetch_spec != NULL) {
+		prefetch_parse_list(prefetch_spec, h.levels, h.num_levels);
+	}
+
+	trace_access_t *batch = malloc(sizeof(trace_access_t) * SWEEP_BATCH);
+	if (batch == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	trace_reader_t *trace = trace_open(trace_fn);
+	split_buf_t split = { NULL, 0 };
+	int n;
+	while ((n = read_trace_batch(trace, batch, SWEEP_BATCH)) > 0) {
+		trace_access_t *accs = split_batch(batch, &n, h.levels[0].b, &split);
+		for (int i = 0; i < n; i++) {
+			current_pc = accs[i].pc;
+			current_cont = accs[i].cont;
+			if (accs[i].op == 'S') {
+				hier_access(&h, accs[i].addr, 1);
+			} else {
+				hier_access(&h, accs[i].addr, 0);
+				if (accs[i].op == 'M') {
+					hier_access(&h, accs[i].addr, 1);
+				}
+			}
+		}
+	}
+	trace_close(trace);
+	free(split.accs);
+	free(batch);
+
+	printf("inclusion:%s\n", inclusion_names[inclusion]);
+	for (int i = 0; i < h.num_levels; i++) {
+		cache_sim_t *c = &h.levels[i];
+		printf("L%d (s:%d E:%d b:%d) hits:%lld misses:%lld evictions:%lld writebacks:%lld",
+				i + 1, c->s, c->E, c->b, c->hits, c->misses, c->evictions, c->writebacks);
+		if (inclusion == INCLUSION_INCLUSIVE && i + 1 < h.num_levels) {
+			printf(" back_invalidations:%lld", h.back_invalidations[i]);
+		}
+		printf("\n");
+		if (c->pf != NULL) {
+			char label[16];
+			snprintf(label, sizeof(label), "L%d ", i + 1);
+			print_prefetch(label, c->pf);
+			free(c->pf);
+		}
+		cache_free(c);
+	}
+	printf("memory reads:%lld writes:%lld\n", h.mem_reads, h.mem_writes);
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Sampling mode **************************************************************/
+
+//Type sample_t: Settings and counts of a sampled run. Set sampling
+//simulates only sets whose index is a multiple of set_step. Time sampling
+//splits the trace into periods of "period" records: the last "window"
+//records of each are measured, the "warmup" records before them only
+//update the cache, and the rest are skipped without being parsed. A
+//trailing partial period counts as a window of whatever it measured.
+typedef struct sample {
+	int set_step;           //1 without set sampling
+	int num_sets;           //number of sampled sets
+	long long *set_counts;  //hits, misses, evictions of each sampled set
+	long long period;       //0 without time sampling
+	long long window;
+	long long warmup;
+	double *windows;        //hits, misses, evictions, measured records of each window
+	long long num_windows;
+	long long max_windows;
+	long long records;      //all data records in the trace
+	long long simulated;    //records that were parsed and simulated
+} sample_t;
+
+/*
+ * t_quantile:
+ * Returns the two sided 95% quantile of Student's t distribution with
+ * "df" degrees of freedom.
+ */
+double t_quantile(long long df) {
+	static const double t95[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if (df < 1) {
+		return INFINITY;
+	}
+	return df <= 30 ? t95[df - 1] : 1.96;
+}
+
+/*
+ * sample_estimate:
+ * Estimates the total of a population of "population" units from "n"
+ * samples, "stride" doubles apart in "values", and stores the
+ * 95% confidence half width (with finite population correction) in
+ * "*half".
+ */
+double sample_estimate(const double *values, int stride, long long n, double population,
+		double *half) {
+	double sum = 0, sq = 0;
+
+	for (long long i = 0; i < n; i++) {
+		sum += values[i * stride];
+	}
+	double mean = n ? sum / n : 0;
+	for (long long i = 0; i < n; i++) {
+		double d = values[i * stride] - mean;
+		sq += d * d;
+	}
+
+	double fpc = population > n ? 1 - n / population : 0;
+	*half = n > 1 ? t_quantile(n - 1) * population * sqrt(sq / (n - 1) / n * fpc) : INFINITY;
+	return mean * population;
+}
+
+/*
+ * window_estimate:
+ * Estimates the total of count "k" (0 hits, 1 misses, 2 evictions) of a
+ * time sampled run: the windows' counts plus, for every record outside
+ * them, the windows' count per record. Stores the 95% confidence half width
+ * from the spread of the per record rates between windows in "*half"; it
+ * is 0 when every record was measured and infinite with one window.
+ */
+double window_estimate(sample_t *sp, int k, double *half) {
+	double counted = 0, measured = 0, sq = 0;
+	long long n = sp->num_windows;
+
+	for (long long i = 0; i < n; i++) {
+		counted += sp->windows[i * 4 + k];
+		measured += sp->windows[i * 4 + 3];
+	}
+	double rate = measured > 0 ? counted / measured : 0;
+	for (long long i = 0; i < n; i++) {
+		double d = sp->windows[i * 4 + k] / sp->windows[i * 4 + 3] - rate;
+		sq += d * d;
+	}
+
+	double rest = sp->records - measured;
+	double fpc = sp->records > 0 ? rest / sp->records : 0;
+	if (rest <= 0) {
+		*half = 0;
+	} else {
+		*half = n > 1 ? t_quantile(n - 1) * rest * sqrt(sq / (n - 1) / n * fpc) : INFINITY;
+	}
+	return counted + rest * rate;
+}
+
+/*
+ * sample_record:
+ * Simulates one access of a sampled run, counting it if "measure" is set
+ * and its set is sampled.
+ */
+static inline void sample_record(sample_t *sp, trace_access_t *acc, int measure, double *window) {
+	unsigned long long set_index = (acc->addr >> sim.b) & (sim.S - 1);
+	if (set_index % sp->set_step != 0) {
+		return;
+	}
+
+	int result = acc->op == 'S' ? cache_access_rw(&sim, acc->addr, 1, acc->len)
+		: cache_access(&sim, acc->addr);
+	if (!measure) {
+		return;
+	}
+	long long *counts = &sp->set_counts[set_index / sp->set_step * 3];
+	int kind = result == ACCESS_HIT ? 0 : 1;
+	counts[kind]++;
+	window[kind]++;
+	if (result == ACCESS_EVICT) {
+		counts[2]++;
+		window[2]++;
+	}
+}
+
+/*
+ * sample_push_window:
+ * Appends the counts of a finished window to the run and clears them.
+ */
+void sample_push_window(sample_t *sp, double *window) {
+	if (sp->num_windows == sp->max_windows) {
+		sp->max_windows = sp->max_windows ? sp->max_windows * 2 : 1024;
+		sp->windows = realloc(sp->windows, sp->max_windows * 4 * sizeof(double));
+		if (sp->windows == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+	}
+	memcpy(&sp->windows[sp->num_windows++ * 4], window, 4 * sizeof(double));
+	memset(window, 0, 4 * sizeof(double));
+}
+
+/*
+ * sample_trace:
+ * Replays a trace with set and/or time sampling and prints the estimated
+ * hits, misses and evictions of the whole trace with 95% confidence
+ * intervals. With time sampling the intervals come from the spread between
+ * windows; with set sampling alone, from the spread between sampled sets.
+ */
+void sample_trace(char *trace_fn, sample_t *sp) {
+	char *buf;
+	trace_access_t acc;
+	split_buf_t split = { NULL, 0 };
+	double window[4] = { 0, 0, 0, 0 };
+	trace_reader_t *trace = trace_open(trace_fn);
+
+	sp->num_sets = (sim.S + sp->set_step - 1) / sp->set_step;
+	sp->set_counts = calloc(sp->num_sets * 3, sizeof(long long));
+	if (sp->set_counts == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+
+	long long skip = sp->period - sp->window - sp->warmup;
+	while ((buf = trace_next_line(trace)) != NULL) {
+		if (buf[0] != ' ' || (buf[1] != 'L' && buf[1] != 'S' && buf[1] != 'M')) {
+			continue;
+		}
+		long long pos = sp->period ? sp->records % sp->period : 0;
+		sp->records++;
+		if (pos < skip) {
+			continue;
+		}
+
+		parse_trace_line(buf, &acc);
+		sp->simulated++;
+		int measure = !sp->period || pos >= sp->period - sp->window;
+		window[3] += measure;
+		int n = 1;
+		trace_access_t *pieces = split_batch(&acc, &n, b, &split);
+		for (int i = 0; i < n; i++) {
+			trace_access_t *p = &pieces[i];
+			if (p->op == 'M') {
+				p->op = 'L';
+				sample_record(sp, p, measure, window);
+				p->op = 'S';
+			}
+			sample_record(sp, p, measure, window);
+		}
+
+		if (sp->period && pos == sp->period - 1) {
+			sample_push_window(sp, window);
+		}
+	}
+	if (sp->period && window[3] > 0) {
+		sample_push_window(sp, window);
+	}
+	trace_close(trace);
+	free(split.accs);
+
+	const char *names[3] = { "hits", "misses", "evictions" };
+	double est[3], half[3];
+	if (sp->period) {
+		// the windows only saw the sampled sets
+		double scale = (double) sim.S / sp->num_sets;
+		for (int k = 0; k < 3; k++) {
+			est[k] = window_estimate(sp, k, &half[k]) * scale;
+			half[k] *= scale;
+		}
+	} else {
+		double *per_set = malloc(sp->num_sets * 3 * sizeof(double));
+		if (per_set == NULL) {
+			printf("Error: malloc failed");
+			exit(1);
+		}
+		for (int i = 0; i < sp->num_sets * 3; i++) {
+			per_set[i] = sp->set_counts[i];
+		}
+		for (int k = 0; k < 3; k++) {
+			est[k] = sample_estimate(per_set + k, 3, sp->num_sets, sim.S, &half[k]);
+		}
+		free(per_set);
+	}
+
+	printf("estimated");
+	for (int k = 0; k < 3; k++) {
+		if (isinf(half[k])) {
+			printf(" %s:%.0f+-n/a", names[k], est[k]);
+		} else {
+			printf(" %s:%.0f+-%.0f", names[k], est[k], half[k]);
+		}
+	}
+	printf("\n");
+	printf("miss ratio:%.4f sampled sets:%d/%d windows:%lld simulated records:%lld/%lld (%.1f%%)\n",
+			est[0] + est[1] > 0 ? est[1] / (est[0] + est[1]) : 0.0, sp->num_sets, sim.S,
+			sp->num_windows, sp->simulated, sp->records,
+			sp->records ? 100.0 * sp->simulated / sp->records : 0.0);
+	free(sp->set_counts);
+	free(sp->windows);
+}
+
+/*
+ * sample_parse_windows:
+ * Parses "period:window[:warmup]" for time sampling. The warm-up defaults
+ * to the window length.
+ */
+void sample_parse_windows(char *spec, sample_t *sp) {
+	int fields = sscanf(spec, "%lld:%lld:%lld", &sp->period, &sp->window, &sp->warmup);
+	if (fields == 2) {
+		sp->warmup = sp->window;
+	}
+	if (fields < 2 || sp->window < 1 || sp->warmup < 0
+			|| sp->window + sp->warmup > sp->period) {
+		fprintf(stderr, "Bad time sampling \"%s\", expected period:window[:warmup]\n", spec);
+		exit(1);
+	}
+}
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* Checkpoints ****************************************************************/
+
+//First bytes of a checkpoint file; the digit is the format version.
+#define CHECKPOINT_MAGIC "CSIMCKP2"
+
+//Line flags in a checkpoint.
+#define CKPT_VALID      1
+#define CKPT_DIRTY      2
+#define CKPT_PREFETCHED 4
+
+//Type checkpoint_header_t: Start of a checkpoint file. It's followed by
+//the S words of per set policy state, then for every line a flags byte
+//and, for valid lines only, the tag and policy counter. Everything is in
+//the host's byte order.
+typedef struct checkpoint_header {
+	char magic[8];
+	int s, E, b;
+	int policy;
+	int write_through, write_allocate;
+	int write_stats; //the run printed the write counters (-w)
+	unsigned long long stamp;
+	long long hits, misses, evictions;
+	long long writebacks, mem_read_bytes, mem_write_bytes;
+} checkpoint_header_t;
+
+/*
+ * checkpoint_save:
+ * Writes the full state of a cache (lines, replacement state and counters)
+ * to "fn".
+ */
+void checkpoint_save(char *fn, cache_sim_t *c) {
+	FILE *out = fopen(fn, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Cannot write checkpoint %s: %s\n", fn, strerror(errno));
+		exit(1);
+	}
+
+	checkpoint_header_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic));
+	hdr.s = c->s;
+	hdr.E = c->E;
+	hdr.b = c->b;
+	hdr.policy = c->policy;
+	hdr.write_through = c->write_through;
+	hdr.write_allocate = c->write_allocate;
+	hdr.write_stats = write_stats;
+	hdr.stamp = c->stamp;
+	hdr.hits = c->hits;
+	hdr.misses = c->misses;
+	hdr.evictions = c->evictions;
+	hdr.writebacks = c->writebacks;
+	hdr.mem_read_bytes = c->mem_read_bytes;
+	hdr.mem_write_bytes = c->mem_write_bytes;
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fwrite(c->set_state, sizeof(unsigned long long), c->S, out);
+
+	for (int i = 0; i < c->S; i++) {
+		for (int j = 0; j < c->E; j++) {
+			cache_line_t *line = &c->sets[i][j];
+			unsigned char flags = (line->valid ? CKPT_VALID : 0) | (line->dirty ? CKPT_DIRTY : 0)
+				| (line->prefetched ? CKPT_PREFETCHED : 0);
+			fputc(flags, out);
+			if (line->valid) {
+				fwrite(&line->tag, sizeof(line->tag), 1, out);
+				fwrite(&line->counter, sizeof(line->counter), 1, out);
+			}
+		}
+	}
+
+	if (ferror(out) | fclose(out)) {
+		fprintf(stderr, "Cannot write checkpoint %s: %s\n", fn, strerror(errno));
+		exit(1);
+	}
+}
+
+/*
+ * checkpoint_open:
+ * Opens the checkpoint "fn", reads its header into "hdr" and returns the
+ * file positioned after it.
+ */
+FILE *checkpoint_open(char *fn, checkpoint_header_t *hdr) {
+	FILE *in = fopen(fn, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Cannot open checkpoint %s: %s\n", fn, strerror(errno));
+		exit(1);
+	}
+	if (fread(hdr, sizeof(*hdr), 1, in) != 1
+			|| memcmp(hdr->magic, CHECKPOINT_MAGIC, sizeof(hdr->magic)) != 0) {
+		fprintf(stderr, "%s is not a csim checkpoint\n", fn);
+		exit(1);
+	}
+	return in;
+}
+
+/*
+ * checkpoint_restore:
+ * Reads the rest of a checkpoint opened by checkpoint_open() into a cache
+ * made with the same geometry, and closes it.
+ */
+void checkpoint_restore(FILE *in, checkpoint_header_t *hdr, cache_sim_t *c) {
+	int ok = fread(c->set_state, sizeof(unsigned long long), c->S, in) == (size_t) c->S;
+
+	for (int i = 0; i < c->S && ok; i++) {
+		for (int j = 0; j < c->E && ok; j++) {
+			cache_line_t *line = &c->sets[i][j];
+			int flags = fgetc(in);
+			ok = flags != EOF;
+			line->valid = (flags & CKPT_VALID) != 0;
+			line->dirty = (flags & CKPT_DIRTY) != 0;
+			line->prefetched = (flags & CKPT_PREFETCHED) != 0;
+			if (ok && line->valid) {
+				ok = fread(&line->tag, sizeof(line->tag), 1, in) == 1
+					&& fread(&line->counter, sizeof(line->counter), 1, in) == 1;
+			}
+		}
+	}
+	if (!ok) {
+		fprintf(stderr, "Checkpoint is truncated\n");
+		exit(1);
+	}
+	fclose(in);
+
+	c->stamp = hdr->stamp;
+	c->hits = hdr->hits;
+	c->misses = hdr->misses;
+	c->evictions = hdr->evictions;
+	c->writebacks = hdr->writebacks;
+	c->mem_read_bytes = hdr->mem_read_bytes;
+	c->mem_write_bytes = hdr->mem_write_bytes;
+}
 /******************************************************************************/
 
 
-//Type mem_addr_t: Use when dealing with addresses or address masks.
-typedef unsigned long long int mem_addr_t;
+/******************************************************************************/
+/* Coherence mode *************************************************************/
 
-//Type cache_line_t: Use when dealing with cache lines.
-//TODO - COMPLETE THIS TYPE
-typedef struct cache_line {
-        char valid;
-        mem_addr_t tag;
-        //Add a data member as needed by your implementation for LRU tracking.
-        int counter;
-} cache_line_t;
+//At most this many cores, each with its own trace and private cache.
+#define MAX_CORES 16
 
-//Type cache_set_t: Use when dealing with cache sets
-//Note: Each set is a pointer to a heap array of one or more cache lines.
-typedef cache_line_t* cache_set_t;
+//How the per-core traces are merged.
+#define INTERLEAVE_RR 0 //one record from each core in turn
+#define INTERLEAVE_TS 1 //by the timestamp after each record
 
-//Type cache_t: Use when dealing with the cache.
-//Note: A cache is a pointer to a heap array of one or more sets.
-typedef cache_set_t* cache_t;
+//Blocks listed in the coherence report when -A isn't given.
+#define COH_TOP 10
 
-// Create the cache we're simulating.
-//Note: A cache is a pointer to a heap array of one or more cache sets.
-cache_t cache;
+//Type coh_block_t: Sharing history of one block that has been invalidated
+//at least once. A core is stale from losing its copy to a write until its
+//next miss on the block; "written" has the granules others wrote
+//meanwhile. A stale core's miss is a coherence miss, and false sharing if
+//it touches none of those granules.
+typedef struct coh_block {
+	mem_addr_t block;
+	unsigned int stale;                    //bit per core
+	unsigned long long written[MAX_CORES]; //granule mask per stale core
+	long long invalidations;
+	long long coherence_misses;
+	long long false_sharing;
+} coh_block_t;
 
-/* TODO - COMPLETE THIS FUNCTION
- * init_cache:
- * Allocates the data structure for a cache with S sets and E lines per set.
- * Initializes all valid bits and tags with 0s.
+//Type coh_part_t: Cores, shared LLC and statistics for one partition of
+//the sets. All partitions share the line arrays; a partition only touches
+//the sets it owns, so partitions can run on different threads.
+typedef struct coh_part {
+	spsc_ring_t ring;
+	cache_sim_t l1[MAX_CORES];
+	cache_sim_t llc;
+	int num_cores;
+	int has_llc;
+	addr_map_t blocks;  //block -> index in "stats"
+	coh_block_t *stats;
+	long long num_stats;
+	long long max_stats;
+	long long invalidations;
+	long long coherence_misses;
+	long long false_sharing;
+	long long upgrades;   //writes to a shared line
+	long long transfers;  //misses served by another core's cache
+	long long mem_reads;
+	long long mem_writes;
+	pthread_t thread;
+} coh_part_t;
+
+/*
+ * coh_mask:
+ * Returns the granules of its block that an access touches. A block is cut
+ * into at most 64 granules, one byte each for blocks up to 64 bytes.
  */
-void init_cache() {
-	S = 1 << s;
-	B = 1 << b;
+static inline unsigned long long coh_mask(mem_addr_t addr, unsigned int len, int b) {
+	int shift = b > 6 ? b - 6 : 0;
+	unsigned long long off = addr & ((1ULL << b) - 1);
+	unsigned long long last = off + (len ? len : 1) - 1;
 
-	// allocate memory for cache with S sets
-	cache = (cache_set_t*) malloc(sizeof(cache_set_t) * S);
-	if (cache == NULL) {
-		printf("Error: malloc failed");
-		exit(1);
+	if (last >= 1ULL << b) {
+		last = (1ULL << b) - 1;
 	}
+	int first = off >> shift;
+	int count = (last >> shift) - first + 1;
+	return (count == 64 ? ~0ULL : (1ULL << count) - 1) << first;
+}
 
-	// allocate memory for E lines per set in cache with S sets
-	for (int i = 0; i < S; i++) {
-		cache[i] = (cache_line_t*) malloc(sizeof(cache_line_t) * E);
-		if (cache[i] == NULL) {
-			printf("Error: malloc failed");
-			exit(1);
-		}
+/*
+ * coh_stats:
+ * Returns the sharing history of "block", adding an empty one if "create"
+ * is set, or NULL.
+ */
+coh_block_t *coh_stats(coh_part_t *p, mem_addr_t block, int create) {
+	if (!create) {
+		addr_map_entry_t *e = p->num_stats ? addr_map_find(&p->blocks, block) : NULL;
+		return e ? &p->stats[e->value] : NULL;
+	}
 
-		// initializes all valid bits and tags with 0s
-		for (int j = 0; j < E; j++) {
-			cache[i][j].valid = 0;
-				cache[i][j].tag = 0;
-				cache[i][j].counter = 0;
+	int added;
+	addr_map_entry_t *e = addr_map_insert(&p->blocks, block, p->num_stats, &added);
+	if (added) {
+		if (p->num_stats == p->max_stats) {
+			p->max_stats = p->max_stats ? p->max_stats * 2 : 1024;
+			p->stats = realloc(p->stats, p->max_stats * sizeof(coh_block_t));
+			if (p->stats == NULL) {
+				printf("Error: malloc failed");
+				exit(1);
+			}
 		}
+		memset(&p->stats[p->num_stats], 0, sizeof(coh_block_t));
+		p->stats[p->num_stats++].block = block;
 	}
+	return &p->stats[e->value];
 }
 
-/* TODO - COMPLETE THIS FUNCTION
- * free_cache:
- * Frees all heap allocated memory used by the cache.
+/*
+ * coh_llc_fetch:
+ * Reads a block into a private cache from the LLC, or from memory.
  */
-void free_cache() {
-	// free memory used by the sets
-	for (int i = 0; i < S; i++) {
-		free(cache[i]);
+void coh_llc_fetch(coh_part_t *p, mem_addr_t addr) {
+	mem_addr_t victim;
+	int victim_dirty;
+
+	if (!p->has_llc) {
+		p->mem_reads++;
+	} else if (cache_probe(&p->llc, addr, 1) != NULL) {
+		p->llc.hits++;
+	} else {
+		p->llc.misses++;
+		p->mem_reads++;
+		if (cache_install(&p->llc, addr, 0, 0, &victim, &victim_dirty) && victim_dirty) {
+			p->mem_writes++;
+		}
 	}
+}
 
-	// free memory used by cache
-	free(cache);
+/*
+ * coh_llc_writeback:
+ * Writes a modified block from a private cache back to the LLC, or to
+ * memory.
+ */
+void coh_llc_writeback(coh_part_t *p, mem_addr_t addr) {
+	mem_addr_t victim;
+	int victim_dirty;
+
+	if (!p->has_llc) {
+		p->mem_writes++;
+		return;
+	}
+	cache_line_t *line = cache_probe(&p->llc, addr, 0);
+	if (line != NULL) {
+		line->dirty = 1;
+	} else if (cache_install(&p->llc, addr, 1, 0, &victim, &victim_dirty) && victim_dirty) {
+		p->mem_writes++;
+	}
 }
 
+/*
+ * coh_written:
+ * Records that "core" wrote "mask" of "block" for the cores that are
+ * stale on it.
+ */
+static inline void coh_written(coh_part_t *p, int core, mem_addr_t block, unsigned long long mask) {
+	coh_block_t *st = coh_stats(p, block, 0);
+	if (st == NULL) {
+		return;
+	}
+	for (int j = 0; j < p->num_cores; j++) {
+		if (j != core && (st->stale >> j & 1)) {
+			st->written[j] |= mask;
+		}
+	}
+}
 
-/* TODO - COMPLETE THIS FUNCTION
- * access_data:
- * Simulates data access at given "addr" memory address in the cache.
- *
- * If already in cache, increment hit_cnt
- * If not in cache, cache it (set tag), increment miss_cnt
- * If a line is evicted, increment evict_cnt
+/*
+ * coh_snoop:
+ * Makes the other cores' copies of "addr" consistent with a read (write
+ * is 0) or a read for ownership (write is 1) by "core": modified copies
+ * are written back, and they become Shared or are invalidated. Returns 1
+ * if another core had a copy.
  */
-void access_data(mem_addr_t addr) {
-	// get the set number
-	int set_number = (addr >> b) & (S - 1);
-	// get the tag
-	mem_addr_t tag = addr >> (s + b);
+int coh_snoop(coh_part_t *p, int core, mem_addr_t addr, int write, unsigned long long mask) {
+	int b = p->l1[0].b;
+	int shared = 0;
 
-	// check if already in the cache
-	cache_set_t set = cache[set_number];
-	int max_counter = 0;
-	int accessed_index = -1;
+	for (int j = 0; j < p->num_cores; j++) {
+		cache_line_t *line = j == core ? NULL : cache_probe(&p->l1[j], addr, 0);
+		if (line == NULL) {
+			continue;
+		}
+		shared = 1;
+		if (line->mesi == MESI_M) {
+			coh_llc_writeback(p, addr);
+			line->dirty = 0;
+		}
+		if (!write) {
+			line->mesi = MESI_S;
+			continue;
+		}
 
-	for (int i = 0; i < E; i++) {
-		cache_line_t *line = &set[i];
+		line->valid = 0;
+		line->mesi = MESI_I;
+		coh_block_t *st = coh_stats(p, addr >> b, 1);
+		st->invalidations++;
+		st->stale |= 1u << j;
+		st->written[j] = mask;
+		p->invalidations++;
+	}
+	return shared;
+}
+
+/*
+ * coh_access:
+ * Simulates a load or store by "core" in its private cache, keeping the
+ * other private caches coherent with MESI.
+ */
+void coh_access(coh_part_t *p, int core, mem_addr_t addr, unsigned int len, int write) {
+	cache_sim_t *c = &p->l1[core];
+	mem_addr_t block = addr >> c->b;
+	unsigned long long mask = coh_mask(addr, len, c->b);
+	cache_line_t *line = cache_probe(c, addr, 1);
 
-		// cache hit if the line is valid and has the requested tag
-		if (line->valid && line->tag == tag) {
-			hit_cnt++;
+	if (line != NULL) {
+		c->hits++;
+		if (write) {
+			if (line->mesi == MESI_S) {
+				p->upgrades++;
+				coh_snoop(p, core, addr, 1, mask);
+			}
+			line->mesi = MESI_M;
+			line->dirty = 1;
+			coh_written(p, core, block, mask);
+		}
+		return;
+	}
 
-			// update the counter for the accessed line
-			accessed_index = i;
-			max_counter = line->counter;
+	c->misses++;
+	coh_block_t *st = coh_stats(p, block, 0);
+	if (st != NULL && (st->stale >> core & 1)) {
+		st->stale &= ~(1u << core);
+		st->coherence_misses++;
+		p->coherence_misses++;
+		if ((st->written[core] & mask) == 0) {
+			st->false_sharing++;
+			p->false_sharing++;
 		}
+	}
 
-		// update other lines counters
-		if (accessed_index != -1) {
-			for (int i = 0; i < E; i++) {
-				cache_line_t *line = &set[i];
+	int shared = coh_snoop(p, core, addr, write, mask);
+	if (shared) {
+		p->transfers++;
+	} else {
+		coh_llc_fetch(p, addr);
+	}
 
-				if (line->counter > set[accessed_index].counter) {
-					line->counter--;
-				} else if (line->counter < set[accessed_index].counter && i != accessed_index) {
-					line->counter++;
-				}
+	mem_addr_t victim;
+	int victim_dirty;
+	if (cache_install(c, addr, write, 0, &victim, &victim_dirty) && victim_dirty) {
+		coh_llc_writeback(p, victim);
+	}
+	cache_probe(c, addr, 0)->mesi = write ? MESI_M : shared ? MESI_S : MESI_E;
+	if (write) {
+		coh_written(p, core, block, mask);
+	}
+}
+
+/*
+ * coh_replay:
+ * Simulates one trace record of the core in "acc->core".
+ */
+static inline void coh_replay(coh_part_t *p, const trace_access_t *acc) {
+	if (acc->op != 'S') {
+		coh_access(p, acc->core, acc->addr, acc->len, 0);
+	}
+	if (acc->op != 'L') {
+		coh_access(p, acc->core, acc->addr, acc->len, 1);
+	}
+}
+
+/*
+ * coh_part_run:
+ * Consumer side of a partition's ring, like set_worker_run().
+ */
+void *coh_part_run(void *arg) {
+	coh_part_t *p = arg;
+	spsc_ring_t *r = &p->ring;
+	unsigned long long head = 0;
+
+	while (1) {
+		unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+		if (head == tail) {
+			if (atomic_load_explicit(&r->done, memory_order_acquire)
+					&& head == atomic_load_explicit(&r->tail, memory_order_acquire)) {
+				break;
 			}
+			sched_yield();
+			continue;
+		}
 
-			// update the counter for the accessed line and return
-			set[accessed_index].counter = max_counter + 1;
-			return;
+		for (; head != tail; head++) {
+			coh_replay(p, &r->slots[head & (RING_SIZE - 1)]);
 		}
+		atomic_store_explicit(&r->head, head, memory_order_release);
 	}
+	return NULL;
+}
 
+//Type coh_input_t: A core's trace and its next record.
+typedef struct coh_input {
+	trace_reader_t *trace;
+	trace_access_t next;
+	unsigned long long ts;
+	int has_next;
+} coh_input_t;
 
-	// cache miss
-	miss_cnt++;
+/*
+ * coh_input_next:
+ * Reads a core's next data record. Its timestamp is the number after the
+ * size (" L addr,size ts"), or the previous one plus 1 if there is none.
+ */
+void coh_input_next(coh_input_t *in, int core) {
+	char *buf;
 
-	// find an empty line in the set
-	int empty_index = -1;
-	for (int i = 0; i < E; i++) {
-		cache_line_t *line = &set[i];
-		if (!line->valid) {
-			empty_index = i;
-			break;
+	in->has_next = 0;
+	while ((buf = trace_next_line(in->trace)) != NULL) {
+		if (parse_trace_line(buf, &in->next)) {
+			const char *p = strchr(buf + 3, ' ');
+			in->ts = p != NULL ? strtoull(p, NULL, 10) : in->ts + 1;
+			in->next.core = core;
+			in->has_next = 1;
+			return;
 		}
 	}
+}
 
-	// if empty line found
-	if (empty_index != -1) {
-		// add the new line to the set
-		set[empty_index].valid = 1;
-		set[empty_index].tag = tag;
+/*
+ * coh_compare:
+ * Orders sharing histories by coherence misses, then invalidations.
+ */
+int coh_compare(const void *x, const void *y) {
+	const coh_block_t *a = x, *b = y;
+	if (a->coherence_misses != b->coherence_misses) {
+		return a->coherence_misses < b->coherence_misses ? 1 : -1;
+	}
+	if (a->invalidations != b->invalidations) {
+		return a->invalidations < b->invalidations ? 1 : -1;
+	}
+	return a->block < b->block ? -1 : a->block > b->block;
+}
 
-		// find the maximum counter value among the lines in the same set as the accessed line
-		for (int i = 0; i < E; i++) {
-			cache_line_t *line = &set[i];
+/*
+ * coherence_trace:
+ * Replays the comma separated per-core traces in "trace_list" against
+ * private s:E:b caches kept coherent with MESI, in front of an optional
+ * shared, non-inclusive LLC ("llc_spec", NULL for none). The merged
+ * stream is split by set over "num_threads" partitions when the set index
+ * bits allow it. Prints the counters of every cache and the "top_n" most
+ * contended blocks.
+ */
+void coherence_trace(char *trace_list, int interleave, char *llc_spec, int num_threads, int top_n) {
+	coh_input_t inputs[MAX_CORES];
+	int num_cores = 0;
+	int llc_s = s, llc_E = 0, llc_b = b;
+	char extra;
 
-			if (line->counter > max_counter) {
-				max_counter = line->counter;
-			}
+	char *copy = strdup(trace_list);
+	char *save = NULL;
+	for (char *fn = strtok_r(copy, ",", &save); fn != NULL; fn = strtok_r(NULL, ",", &save)) {
+		if (num_cores == MAX_CORES) {
+			fprintf(stderr, "At most %d cores are supported\n", MAX_CORES);
+			exit(1);
 		}
-
-		// update counter and return
-		set[empty_index].counter = max_counter + 1;
-		return;
+		memset(&inputs[num_cores], 0, sizeof(coh_input_t));
+		inputs[num_cores++].trace = trace_open(fn);
 	}
+	free(copy);
 
-	// if no empty line found, evict the LRU line
-	evict_cnt++;
+	if (llc_spec != NULL && (sscanf(llc_spec, "%d:%d:%d%c", &llc_s, &llc_E, &llc_b, &extra) != 3
+			|| llc_s < 0 || llc_E <= 0 || llc_b != b || llc_s + llc_b >= 64)) {
+		fprintf(stderr, "Bad LLC \"%s\", expected s:E:b with the same b as the cores\n", llc_spec);
+		exit(1);
+	}
 
-	// find max counter
-	int max_set_counter = 0;
-	for (int i = 0; i < E; i++) {
-		cache_line_t *line = &set[i];
+	// partitions own sets by the index bits the private caches and the LLC share
+	int part_bits = llc_s < s ? llc_s : s;
+	int num_parts = num_threads > 1 ? num_threads : 1;
+	if (num_parts > 1 << part_bits) {
+		num_parts = 1 << part_bits;
+	}
 
-		if (line->counter > max_set_counter) {
-			max_set_counter = line->counter;
+	coh_part_t *parts = NULL;
+	if (posix_memalign((void **) &parts, 64, sizeof(coh_part_t) * num_parts) != 0) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	memset(parts, 0, sizeof(coh_part_t) * num_parts);
+	for (int i = 0; i < num_cores; i++) {
+		cache_init(&parts[0].l1[i], s, E, b);
+	}
+	if (llc_spec != NULL) {
+		cache_init(&parts[0].llc, llc_s, llc_E, llc_b);
+	}
+	for (int k = 0; k < num_parts; k++) {
+		coh_part_t *p = &parts[k];
+		if (k > 0) {
+			memcpy(p->l1, parts[0].l1, sizeof(p->l1));
+			p->llc = parts[0].llc;
+		}
+		p->num_cores = num_cores;
+		p->has_llc = llc_spec != NULL;
+		addr_map_init(&p->blocks, 1024);
+		atomic_init(&p->ring.head, 0);
+		atomic_init(&p->ring.tail, 0);
+		atomic_init(&p->ring.done, 0);
+		if (num_parts > 1 && pthread_create(&p->thread, NULL, coh_part_run, p) != 0) {
+			fprintf(stderr, "Error: pthread_create failed\n");
+			exit(1);
 		}
 	}
 
-	// find min counter
-	int min_counter = INT_MAX;
-	int min_counter_index = -1;
+	for (int i = 0; i < num_cores; i++) {
+		coh_input_next(&inputs[i], i);
+	}
+
+	// merge the traces and route every access to the partition of its set
+	split_buf_t split = { NULL, 0 };
+	int core = num_cores - 1;
+	unsigned long long part_mask = (1ULL << part_bits) - 1;
+	while (1) {
+		int pick = -1;
+		if (interleave == INTERLEAVE_RR) {
+			for (int k = 1; k <= num_cores && pick < 0; k++) {
+				int j = (core + k) % num_cores;
+				if (inputs[j].has_next) pick = j;
+			}
+		} else {
+			for (int j = 0; j < num_cores; j++) {
+				if (inputs[j].has_next && (pick < 0 || inputs[j].ts < inputs[pick].ts)) pick = j;
+			}
+		}
+		if (pick < 0) {
+			break;
+		}
+		core = pick;
 
-	for (int i = 0; i < E; i++) {
-		cache_line_t *line = &set[i];
+		int n = 1;
+		trace_access_t *pieces = split_batch(&inputs[core].next, &n, b, &split);
+		for (int i = 0; i < n; i++) {
+			if (num_parts == 1) {
+				coh_replay(&parts[0], &pieces[i]);
+			} else {
+				unsigned long long k = ((pieces[i].addr >> b) & part_mask) % num_parts;
+				ring_push(&parts[k].ring, &pieces[i]);
+			}
+		}
+		coh_input_next(&inputs[core], core);
+	}
+	for (int i = 0; i < num_cores; i++) {
+		trace_close(inputs[i].trace);
+	}
+	free(split.accs);
 
-		if (line->counter < min_counter) {
-			min_counter = line->counter;
-			min_counter_index = i;
+	// merge the partitions into the first one
+	coh_part_t *total = &parts[0];
+	if (num_parts > 1) {
+		for (int k = 0; k < num_parts; k++) {
+			ring_publish(&parts[k].ring);
+			atomic_store_explicit(&parts[k].ring.done, 1, memory_order_release);
+		}
+		for (int k = 0; k < num_parts; k++) {
+			pthread_join(parts[k].thread, NULL);
 		}
 	}
-	
-	// update the min counter set's tag and counter
-	set[min_counter_index].tag = tag;
-	set[min_counter_index].counter = max_set_counter + 1;
+	for (int k = 1; k < num_parts; k++) {
+		coh_part_t *p = &parts[k];
+		for (int i = 0; i < num_cores; i++) {
+			total->l1[i].hits += p->l1[i].hits;
+			total->l1[i].misses += p->l1[i].misses;
+			total->l1[i].evictions += p->l1[i].evictions;
+		}
+		total->llc.hits += p->llc.hits;
+		total->llc.misses += p->llc.misses;
+		total->llc.evictions += p->llc.evictions;
+		total->invalidations += p->invalidations;
+		total->coherence_misses += p->coherence_misses;
+		total->false_sharing += p->false_sharing;
+		total->upgrades += p->upgrades;
+		total->transfers += p->transfers;
+		total->mem_reads += p->mem_reads;
+		total->mem_writes += p->mem_writes;
+		for (long long i = 0; i < p->num_stats; i++) {
+			*coh_stats(total, p->stats[i].block, 1) = p->stats[i];
+		}
+		addr_map_free(&p->blocks);
+		free(p->stats);
+	}
+
+	printf("coherence:mesi cores:%d interleave:%s partitions:%d\n", num_cores,
+			interleave == INTERLEAVE_RR ? "rr" : "ts", num_parts);
+	for (int i = 0; i < num_cores; i++) {
+		cache_sim_t *c = &total->l1[i];
+		printf("core %d (s:%d E:%d b:%d) hits:%lld misses:%lld evictions:%lld\n",
+				i, c->s, c->E, c->b, c->hits, c->misses, c->evictions);
+		cache_free(c);
+	}
+	if (total->has_llc) {
+		cache_sim_t *c = &total->llc;
+		printf("LLC (s:%d E:%d b:%d) hits:%lld misses:%lld evictions:%lld\n",
+				c->s, c->E, c->b, c->hits, c->misses, c->evictions);
+		cache_free(c);
+	}
+	printf("memory reads:%lld writes:%lld\n", total->mem_reads, total->mem_writes);
+	printf("invalidations:%lld coherence_misses:%lld false_sharing:%lld upgrades:%lld transfers:%lld\n",
+			total->invalidations, total->coherence_misses, total->false_sharing,
+			total->upgrades, total->transfers);
+
+	qsort(total->stats, total->num_stats, sizeof(coh_block_t), coh_compare);
+	if (total->num_stats > 0) {
+		printf("most contended blocks:\n");
+	}
+	for (long long i = 0; i < total->num_stats && i < top_n; i++) {
+		coh_block_t *st = &total->stats[i];
+		printf("  block %llx invalidations:%lld coherence_misses:%lld false_sharing:%lld\n",
+				st->block << b, st->invalidations, st->coherence_misses, st->false_sharing);
+	}
+	addr_map_free(&total->blocks);
+	free(total->stats);
+	free(parts);
 }
+/******************************************************************************/
 
-/* TODO - FILL IN THE MISSING CODE
- * replay_trace:
- * Replays the given trace file against the cache.
- *
- * Reads the input trace file line by line.
- * Extracts the type of each memory access : L/S/M
- * TRANSLATE each "L" as a load i.e. 1 memory access
- * TRANSLATE each "S" as a store i.e. 1 memory access
- * TRANSLATE each "M" as a load followed by a store i.e. 2 memory accesses
- */
-void replay_trace(char* trace_fn) {
-        char buf[1000];
-        mem_addr_t addr = 0;
-        unsigned int len = 0;
-        FILE* trace_fp = fopen(trace_fn, "r");
 
-        if (!trace_fp) {
-                fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
-                exit(1);
-        }
+/*
+ * parse_policy:
+ * Sets the global replacement policy from "name" or "name:seed".
+ * Exits with an error for an unknown policy.
+ */
+void parse_policy(char *arg) {
+	char *colon = strchr(arg, ':');
+	size_t len = colon ? (size_t) (colon - arg) : strlen(arg);
 
-        while (fgets(buf, 1000, trace_fp) != NULL) {
-                if (buf[1] == 'S' || buf[1] == 'L' || buf[1] == 'M') {
-                        sscanf(buf+3, "%llx,%u", &addr, &len);
+	if (colon != NULL) {
+		policy_seed = strtoull(colon + 1, NULL, 0);
+	}
+	for (int i = 0; i < (int) (sizeof(policy_names) / sizeof(policy_names[0])); i++) {
+		if (strlen(policy_names[i]) == len && strncmp(arg, policy_names[i], len) == 0) {
+			policy = i;
+			return;
+		}
+	}
+	fprintf(stderr, "Unknown replacement policy \"%s\"\n", arg);
+	exit(1);
+}
 
-                        if (verbosity)
-                                printf("%c %llx,%u ", buf[1], addr, len);
 
-                        // TODO - MISSING CODE
-                        // GIVEN: 1. addr has the address to be accessed
-                        //        2. buf[1] has type of acccess(S/L/M)
-                        // call access_data function here depending on type of access
-                        if (buf[1] == 'S') {
-                                access_data(addr);
-                        } else if (buf[1] == 'L') {
-                                access_data(addr);
-                        } else if (buf[1] == 'M') {
-                                access_data(addr);
-                                access_data(addr);
-                        }
+/*
+ * parse_write_policy:
+ * Sets the global write policy from "wb" or "wt", optionally followed by
+ * ":wa" (write-allocate, the default) or ":nwa" (no-write-allocate).
+ */
+void parse_write_policy(char *arg) {
+	char *colon = strchr(arg, ':');
+	size_t len = colon ? (size_t) (colon - arg) : strlen(arg);
 
-                        if (verbosity)
-                                printf("\n");
-                }
-        }
+	if (len == 2 && strncmp(arg, "wb", 2) == 0) {
+		write_through = 0;
+	} else if (len == 2 && strncmp(arg, "wt", 2) == 0) {
+		write_through = 1;
+	} else {
+		fprintf(stderr, "Unknown write policy \"%s\"\n", arg);
+		exit(1);
+	}
 
-        fclose(trace_fp);
+	if (colon == NULL || strcmp(colon + 1, "wa") == 0) {
+		write_allocate = 1;
+	} else if (strcmp(colon + 1, "nwa") == 0) {
+		write_allocate = 0;
+	} else {
+		fprintf(stderr, "Unknown write policy \"%s\"\n", arg);
+		exit(1);
+	}
+	write_stats = 1;
 }
 
 
@@ -286,17 +3802,75 @@ void replay_trace(char* trace_fn) {
  * Print information on how to use csim to standard output.
  */
 void print_usage(char* argv[]) {
-        printf("Usage: %s [-hv] -s <num> -E <num> -b <num> -t <file>\n", argv[0]);
+        printf("Usage: %s [-hvlC] -s <num> -E <num> -b <num> [-r <policy>] [-w <policy>]\n", argv[0]);
+        printf("       [-j <num>] [-A <num>] [-R <file>] [-P <prefetcher>] -t <file>\n");
+        printf("       %s -s <num> -E <num> -b <num> [-S <num>] [-W <windows>] -t <file>\n", argv[0]);
+        printf("       %s -i <checkpoint> [-o <checkpoint>] -t <file>\n", argv[0]);
+        printf("       %s -s <num> -E <num> -b <num> -M <rr|ts> [-L <llc>] [-j <num>]\n", argv[0]);
+        printf("       [-A <num>] -t <file,file,...>\n");
+        printf("       %s -c <configs> [-r <policy>] [-j <num>] -t <file>\n", argv[0]);
+        printf("       %s [-v] -d <b list> -t <file>\n", argv[0]);
+        printf("       %s -H <levels> [-I <inclusion>] [-r <policy>] [-P <list>] -t <file>\n", argv[0]);
         printf("Options:\n");
         printf("  -h         Print this help message.\n");
         printf("  -v         Optional verbose flag.\n");
         printf("  -s <num>   Number of s bits for set index.\n");
         printf("  -E <num>   Number of lines per set.\n");
         printf("  -b <num>   Number of b bits for block offsets.\n");
-        printf("  -t <file>  Trace file.\n");
+        printf("  -t <file>  Trace file, a FIFO, or - to read standard input.\n");
+        printf("  -l         Count every block an access covers, using its length.\n");
+        printf("  -C         Classify misses as compulsory, capacity or conflict.\n");
+        printf("  -P <list>  Prefetchers, one per cache level (comma separated):\n");
+        printf("             none, next, stride or stream, each with an optional\n");
+        printf("             :degree, e.g. next:2 or stride,none for a hierarchy.\n");
+        printf("  -A <num>   Attribute misses: print the num hottest sets, blocks\n");
+        printf("             and instructions (from the trace's I lines).\n");
+        printf("  -R <file>  Attribute misses to the address ranges in file, one\n");
+        printf("             \"start end name\" line per range in hex.\n");
+        printf("  -S <num>   Set sampling: simulate only every num-th set.\n");
+        printf("  -W <spec>  Time sampling as period:window[:warmup] records: measure\n");
+        printf("             the last window records of each period after warmup\n");
+        printf("             unmeasured ones (default: window) and skip the rest.\n");
+        printf("             Both print estimates with 95%% confidence intervals.\n");
+        printf("  -o <file>  Save the cache state and counters to a checkpoint after\n");
+        printf("             the run.\n");
+        printf("  -i <file>  Resume from a checkpoint: its geometry and policies are\n");
+        printf("             used and its counters continue.\n");
+        printf("  -M <mode>  Coherence: one comma separated trace per core, merged\n");
+        printf("             round-robin (rr) or by a timestamp after each record\n");
+        printf("             (ts), over private s:E:b caches kept coherent with MESI.\n");
+        printf("             Counts invalidations, coherence misses and false\n");
+        printf("             sharing, and lists the -A most contended blocks.\n");
+        printf("  -L <spec>  Coherence: shared s:E:b LLC behind the private caches.\n");
+        printf("  -r <name>  Replacement policy: lru (default), fifo, random, plru,\n");
+        printf("             bitplru, srrip, brrip or lfu. random and brrip take a\n");
+        printf("             seed as name:seed.\n");
+        printf("  -w <mode>  Write policy wb (write-back) or wt (write-through), with\n");
+        printf("             :wa (write-allocate, default) or :nwa. Prints dirty\n");
+        printf("             evictions and memory traffic after the summary.\n");
+        printf("  -c <list>  Sweep: comma separated s:E:b configurations, each\n");
+        printf("             field a number or a lo-hi range (E ranges double).\n");
+        printf("  -j <num>   Worker threads: sets are split across them in a normal\n");
+        printf("             run, configurations in sweep mode (default: all cores).\n");
+        printf("  -d <list>  Stack distance analysis: LRU miss ratio curve for each\n");
+        printf("             block size b in the list (numbers or lo-hi ranges).\n");
+        printf("  -H <list>  Hierarchy: comma separated s:E:b levels from L1 down,\n");
+        printf("             all write-back/write-allocate with the same b.\n");
+        printf("  -I <name>  Hierarchy inclusion: nine (default), inclusive or exclusive.\n");
         printf("\nExamples:\n");
         printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", argv[0]);
         printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", argv[0]);
+        printf("  linux>  valgrind --tool=lackey --trace-mem=yes --log-fd=1 ./prog \\\n");
+        printf("              | %s -s 8 -E 2 -b 4 -t -\n", argv[0]);
+        printf("  linux>  %s -r plru -s 6 -E 8 -b 6 -t traces/yi.trace\n", argv[0]);
+        printf("  linux>  %s -w wt:nwa -s 4 -E 2 -b 4 -t traces/yi.trace\n", argv[0]);
+        printf("  linux>  %s -c 2-8:1-8:4,4:1:5-6 -t traces/yi.trace\n", argv[0]);
+        printf("  linux>  %s -s 8 -E 2 -b 4 -o warm.ckpt -t traces/yi.trace\n", argv[0]);
+        printf("  linux>  %s -i warm.ckpt -t traces/yi_next.trace\n", argv[0]);
+        printf("  linux>  %s -d 4-6 -t traces/yi.trace\n", argv[0]);
+        printf("  linux>  %s -s 6 -E 8 -b 6 -M rr -L 12:16:6 -t t0.trace,t1.trace\n", argv[0]);
+        printf("  linux>  %s -s 10 -E 8 -b 6 -S 16 -W 100000:5000:20000 -t big.trace\n", argv[0]);
+        printf("  linux>  %s -H 6:8:6,9:8:6,12:16:6 -I inclusive -t traces/yi.trace\n", argv[0]);
         exit(0);
 }
 
@@ -314,6 +3888,18 @@ void print_summary(int hits, int misses, int evictions) {
 }
 
 
+/*
+ * print_write_summary:
+ * Prints the dirty evictions and memory traffic of a cache.
+ */
+void print_write_summary(cache_sim_t *c) {
+        printf("dirty_evictions:%lld mem_read_bytes:%lld mem_write_bytes:%lld\n",
+                        c->writebacks, c->mem_read_bytes, c->mem_write_bytes);
+}
+
+
+//csim_bench.c includes this file with CSIM_NO_MAIN to drive the simulator.
+#ifndef CSIM_NO_MAIN
 /*
  * main:
  * Main parses command line args, makes the cache, replays the memory accesses
@@ -321,20 +3907,99 @@ void print_summary(int hits, int misses, int evictions) {
  */
 int main(int argc, char* argv[]) {
         char* trace_file = NULL;
-        char c;
+        char* sweep_spec = NULL;
+        char* stack_dist_spec = NULL;
+        char* hier_spec = NULL;
+        char* range_map = NULL;
+        int top_n = 0;
+        int classify_misses = 0;
+        char* prefetch_spec = NULL;
+        sample_t sample = { .set_step = 1 };
+        char* save_file = NULL;
+        char* restore_file = NULL;
+        FILE* restore_fp = NULL;
+        checkpoint_header_t restore_hdr;
+        char* coherence_spec = NULL;
+        char* llc_spec = NULL;
+        int inclusion = INCLUSION_NINE;
+        int num_threads = 0;
+        int c;
 
-        // Parse the command line arguments: -h, -v, -s, -E, -b, -t
-        while ((c = getopt(argc, argv, "s:E:b:t:vh")) != -1) {
+        // Parse the command line arguments: -h, -v, -s, -E, -b, -t, -c, -j, -d,
+        // -r, -H, -I, -w, -l, -A, -R, -C, -P, -S, -W, -o, -i, -M, -L
+        while ((c = getopt(argc, argv, "s:E:b:t:c:j:d:r:H:I:w:lA:R:CP:S:W:o:i:M:L:vh")) != -1) {
                 switch (c) {
+                        case 'A':
+                                top_n = atoi(optarg);
+                                break;
                         case 'b':
                                 b = atoi(optarg);
                                 break;
+                        case 'c':
+                                sweep_spec = optarg;
+                                break;
+                        case 'C':
+                                classify_misses = 1;
+                                break;
+                        case 'd':
+                                stack_dist_spec = optarg;
+                                break;
                         case 'E':
                                 E = atoi(optarg);
                                 break;
                         case 'h':
                                 print_usage(argv);
                                 exit(0);
+                        case 'H':
+                                hier_spec = optarg;
+                                break;
+                        case 'I':
+                                for (inclusion = 0; inclusion < 3; inclusion++) {
+                                        if (strcmp(optarg, inclusion_names[inclusion]) == 0)
+                                                break;
+                                }
+                                if (inclusion == 3) {
+                                        fprintf(stderr, "Unknown inclusion policy \"%s\"\n", optarg);
+                                        exit(1);
+                                }
+                                break;
+                        case 'j':
+                                num_threads = atoi(optarg);
+                                break;
+                        case 'l':
+                                split_blocks = 1;
+                                break;
+                        case 'P':
+                                prefetch_spec = optarg;
+                                break;
+                        case 'S':
+                                sample.set_step = atoi(optarg);
+                                if (sample.set_step < 1) {
+                                        print_usage(argv);
+                                        exit(1);
+                                }
+                                break;
+                        case 'o':
+                                save_file = optarg;
+                                break;
+                        case 'M':
+                                coherence_spec = optarg;
+                                break;
+                        case 'L':
+                                llc_spec = optarg;
+                                break;
+                        case 'i':
+                                restore_file = optarg;
+                                break;
+                        case 'W':
+                                sample_parse_windows(optarg, &sample);
+                                break;
+                        case 'r':
+                                parse_policy(optarg);
+                                break;
+                        case 'R':
+                                range_map = optarg;
+                                break;
                         case 's':
                                 s = atoi(optarg);
                                 break;
@@ -344,12 +4009,61 @@ int main(int argc, char* argv[]) {
                         case 'v':
                                 verbosity = 1;
                                 break;
+                        case 'w':
+                                parse_write_policy(optarg);
+                                break;
                         default:
                                 print_usage(argv);
                                 exit(1);
                 }
         }
 
+        //Sweep, stack distance and hierarchy modes don't use -s/-E/-b.
+        if (sweep_spec != NULL || stack_dist_spec != NULL || hier_spec != NULL) {
+                if (trace_file == NULL) {
+                        printf("%s: Missing required command line argument\n", argv[0]);
+                        print_usage(argv);
+                        exit(1);
+                }
+                if (sweep_spec != NULL) {
+                        sweep_trace(trace_file, sweep_spec, num_threads);
+                } else if (stack_dist_spec != NULL) {
+                        stack_dist_trace(trace_file, stack_dist_spec);
+                } else {
+                        hier_trace(trace_file, hier_spec, inclusion, prefetch_spec);
+                }
+                return 0;
+        }
+
+        //Coherence mode has its own caches and report, so it takes none of
+        //the single cache options.
+        if (coherence_spec != NULL && (save_file != NULL || restore_file != NULL
+                        || prefetch_spec != NULL || classify_misses || range_map != NULL
+                        || write_stats || sample.set_step > 1 || sample.period > 0)) {
+                printf("%s: -M can't be combined with -o, -i, -P, -C, -R, -w, -S or -W\n", argv[0]);
+                print_usage(argv);
+                exit(1);
+        }
+
+        //A checkpoint brings its own geometry and policies, so -s, -E and -b
+        //can be left out, but must match it when given.
+        if (restore_file != NULL) {
+                restore_fp = checkpoint_open(restore_file, &restore_hdr);
+                if ((s && s != restore_hdr.s) || (E && E != restore_hdr.E)
+                                || (b && b != restore_hdr.b)) {
+                        printf("%s: -s, -E and -b must match the checkpoint (s:%d E:%d b:%d)\n",
+                                        argv[0], restore_hdr.s, restore_hdr.E, restore_hdr.b);
+                        exit(1);
+                }
+                s = restore_hdr.s;
+                E = restore_hdr.E;
+                b = restore_hdr.b;
+                policy = restore_hdr.policy;
+                write_through = restore_hdr.write_through;
+                write_allocate = restore_hdr.write_allocate;
+                write_stats |= restore_hdr.write_stats;
+        }
+
         //Make sure that all required command line args were specified.
         if (s == 0 || E == 0 || b == 0 || trace_file == NULL) {
                 printf("%s: Missing required command line argument\n", argv[0]);
@@ -357,11 +4071,80 @@ int main(int argc, char* argv[]) {
                 exit(1);
         }
 
-        //Initialize cache.
+        //Coherence mode: -s/-E/-b give every core's private cache.
+        if (coherence_spec != NULL) {
+                int interleave = INTERLEAVE_RR;
+                if (strcmp(coherence_spec, "ts") == 0) {
+                        interleave = INTERLEAVE_TS;
+                } else if (strcmp(coherence_spec, "rr") != 0) {
+                        fprintf(stderr, "Unknown interleaving \"%s\", expected rr or ts\n", coherence_spec);
+                        exit(1);
+                }
+                coherence_trace(trace_file, interleave, llc_spec, num_threads,
+                                top_n > 0 ? top_n : COH_TOP);
+                return 0;
+        }
+
+        //Initialize cache, warmed up from a checkpoint if one was given.
         init_cache();
+        if (restore_fp != NULL) {
+                checkpoint_restore(restore_fp, &restore_hdr, &sim);
+                //The summary counters are ints (DO NOT MODIFY), so a checkpoint
+                //past INT_MAX can't be carried on without wrapping them.
+                if (sim.hits > INT_MAX || sim.misses > INT_MAX || sim.evictions > INT_MAX) {
+                        fprintf(stderr, "Error: checkpoint counts exceed the summary counters "
+                                        "(hits:%lld misses:%lld evictions:%lld)\n",
+                                        sim.hits, sim.misses, sim.evictions);
+                        exit(1);
+                }
+                hit_cnt = sim.hits;
+                miss_cnt = sim.misses;
+                evict_cnt = sim.evictions;
+        }
+
+        //Sampled runs print estimates of the totals instead of the summary.
+        if (sample.set_step > 1 || sample.period > 0) {
+                if (num_threads != 0 || prefetch_spec != NULL || top_n > 0 || range_map != NULL
+                                || classify_misses) {
+                        printf("%s: -S and -W can't be combined with -j, -P, -A, -R or -C\n", argv[0]);
+                        print_usage(argv);
+                        exit(1);
+                }
+                if (sample.set_step > S) {
+                        printf("%s: -S must be between 1 and the number of sets\n", argv[0]);
+                        exit(1);
+                }
+                sample_trace(trace_file, &sample);
+                if (save_file != NULL) {
+                        checkpoint_save(save_file, &sim);
+                }
+                free_cache();
+                return 0;
+        }
+
+        if (classify_misses) {
+                classify_init();
+        }
+        if (prefetch_spec != NULL) {
+                prefetch_parse_list(prefetch_spec, &sim, 1);
+        }
+        if (top_n > 0 || range_map != NULL) {
+                attribution_init(top_n > 0 ? top_n : 10, range_map);
+        }
 
-        //Replay the memory access trace.
-        replay_trace(trace_file);
+        //Replay the memory access trace, split by set when -j is given.
+        //Verbose output, attribution and classification need trace order,
+        //and prefetching, which crosses sets, so they stay serial, as do
+        //checkpoints, which need the whole cache in "sim".
+        if (num_threads > 1 && !verbosity && attribution == NULL && classify == NULL
+                        && sim.pf == NULL && save_file == NULL && restore_fp == NULL) {
+                replay_trace_parallel(trace_file, num_threads);
+        } else {
+                replay_trace(trace_file);
+        }
+        if (save_file != NULL) {
+                checkpoint_save(save_file, &sim);
+        }
 
         //Free memory allocated for cache.
         free_cache();
@@ -369,5 +4152,18 @@ int main(int argc, char* argv[]) {
         //Print the statistics to a file.
         //DO NOT REMOVE: This function must be called for test_csim to work.
         print_summary(hit_cnt, miss_cnt, evict_cnt);
+        if (write_stats) {
+                print_write_summary(&sim);
+        }
+        if (classify != NULL) {
+                print_classify(classify);
+        }
+        if (sim.pf != NULL) {
+                print_prefetch("", sim.pf);
+        }
+        if (attribution != NULL) {
+                print_attribution(attribution);
+        }
         return 0;
 }
+#endif
@@ -0,0 +1,724 @@
+/*
+ * csim_bench.c:
+ * Measures how fast csim itself runs. Deterministic synthetic traces
+ * (sequential, strided, random and the access patterns of the p4A
+ * programs) are generated into temporary files and replayed over a matrix
+ * of (s, E, b) geometries. Three throughputs are timed, in accesses/sec:
+ *  parse       reading and decoding the trace only
+ *  sim         access_data over an already decoded trace
+ *  end_to_end  replay_trace on the trace file, as a normal csim run does
+ *
+ * The results are printed as JSON. With -B they are compared against a
+ * stored baseline and any throughput that dropped by more than the
+ * tolerance is reported as a regression, with exit status 1. -u rewrites
+ * the baseline from this run instead. Both runs also time a fixed
+ * calibration loop, and baseline numbers are scaled by how much faster or
+ * slower it ran, so a baseline stays usable on a different or busy machine.
+ *
+ * -x runs functional checks of mode combinations instead, each in a child
+ * process with its output captured, and exits 1 if any fails.
+ *
+ * Build: gcc -O2 -pthread -o csim_bench csim_bench.c -lm
+ */
+
+#define CSIM_NO_MAIN
+#include "csim.c"
+
+#include <time.h>
+#include <sys/wait.h>
+
+//Geometries timed when -g isn't given.
+#define BENCH_GEOMETRIES "4:1:4,5:2:5,6:4:6,8:8:6,10:16:6"
+
+#define MAX_BENCH_GEOMETRIES 16
+#define MAX_BENCH_RESULTS 128
+
+//Type bench_result_t: Throughputs of one trace on one geometry.
+typedef struct bench_result {
+	char trace[16];
+	int s, E, b;
+	double parse;
+	double sim;
+	double end_to_end;
+} bench_result_t;
+
+//Type bench_trace_t: A synthetic trace pattern.
+typedef struct bench_trace {
+	const char *name;
+	void (*generate)(FILE *out, long long n);
+} bench_trace_t;
+
+/*
+ * gen_sequential:
+ * 4 byte loads walking forward through memory.
+ */
+void gen_sequential(FILE *out, long long n) {
+	for (long long i = 0; i < n; i++) {
+		fprintf(out, " L %llx,4\n", 0x10000000ULL + i * 4);
+	}
+}
+
+/*
+ * gen_strided:
+ * 8 byte loads 72 bytes apart, so consecutive accesses touch new blocks
+ * and drift across block offsets.
+ */
+void gen_strided(FILE *out, long long n) {
+	for (long long i = 0; i < n; i++) {
+		fprintf(out, " L %llx,8\n", 0x10000000ULL + i * 72);
+	}
+}
+
+/*
+ * gen_random:
+ * Loads, stores and modifies scattered over 64MB, from a fixed seed.
+ */
+void gen_random(FILE *out, long long n) {
+	unsigned long long x = 0x9e3779b97f4a7c15ULL;
+	const char ops[] = "LLSM";
+
+	for (long long i = 0; i < n; i++) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		unsigned long long r = x * 0x2545f4914f6cdd1dULL;
+		fprintf(out, " %c %llx,4\n", ops[r & 3], 0x10000000ULL + ((r >> 8) % (64 << 20) & ~3ULL));
+	}
+}
+
+/*
+ * gen_cache1D:
+ * The stores of p4A/cache1D.c, repeated until "n" accesses.
+ */
+void gen_cache1D(FILE *out, long long n) {
+	const int N = 100000;
+
+	for (long long i = 0; i < n; i++) {
+		fprintf(out, " S %llx,4\n", 0x10000000ULL + (i % N) * 4);
+	}
+}
+
+/*
+ * gen_cache2Drows:
+ * The stores of p4A/cache2Drows.c (row major over a 3000x500 int array).
+ */
+void gen_cache2Drows(FILE *out, long long n) {
+	const long long rows = 3000, cols = 500;
+
+	for (long long k = 0; k < n; k++) {
+		long long idx = k % (rows * cols);
+		fprintf(out, " S %llx,4\n", 0x10000000ULL + idx * 4);
+	}
+}
+
+/*
+ * gen_cache2Dcols:
+ * The stores of p4A/cache2Dcols.c (column major over the same array).
+ */
+void gen_cache2Dcols(FILE *out, long long n) {
+	const long long rows = 3000, cols = 500;
+
+	for (long long k = 0; k < n; k++) {
+		long long idx = k % (rows * cols);
+		long long i = idx % rows, j = idx / rows;
+		fprintf(out, " S %llx,4\n", 0x10000000ULL + (i * cols + j) * 4);
+	}
+}
+
+/*
+ * gen_cache2Dclash:
+ * The stores of p4A/cache2Dclash.c (a 128x8 int array swept repeatedly).
+ */
+void gen_cache2Dclash(FILE *out, long long n) {
+	const long long size = 128 * 8;
+
+	for (long long k = 0; k < n; k++) {
+		fprintf(out, " S %llx,4\n", 0x10000000ULL + (k % size) * 4);
+	}
+}
+
+const bench_trace_t bench_traces[] = {
+	{ "sequential", gen_sequential },
+	{ "strided", gen_strided },
+	{ "random", gen_random },
+	{ "cache1D", gen_cache1D },
+	{ "cache2Drows", gen_cache2Drows },
+	{ "cache2Dcols", gen_cache2Dcols },
+	{ "cache2Dclash", gen_cache2Dclash },
+};
+
+#define NUM_BENCH_TRACES (int) (sizeof(bench_traces) / sizeof(bench_traces[0]))
+
+/*
+ * now_sec:
+ * Returns a monotonic time in seconds.
+ */
+double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * calibrate:
+ * Returns the speed, in iterations/sec, of a fixed loop of dependent
+ * loads and arithmetic roughly like the simulator's inner loop.
+ */
+double calibrate() {
+	enum { TABLE = 1 << 16, ITERS = 1 << 24 };
+	unsigned int *table = malloc(TABLE * sizeof(unsigned int));
+	if (table == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	for (unsigned int i = 0; i < TABLE; i++) {
+		table[i] = i * 2654435761u;
+	}
+
+	volatile unsigned int sink;
+	unsigned int x = 1;
+	double start = now_sec();
+	for (int i = 0; i < ITERS; i++) {
+		x = table[(x ^ i) & (TABLE - 1)] + (x >> 3);
+	}
+	double elapsed = now_sec() - start;
+	sink = x;
+	(void) sink;
+	free(table);
+	return ITERS / elapsed;
+}
+
+/*
+ * generate_trace:
+ * Writes "n" accesses of a pattern to a new temporary file and stores its
+ * name in "fn".
+ */
+void generate_trace(const bench_trace_t *t, long long n, char *fn) {
+	strcpy(fn, "/tmp/csim_bench_XXXXXX");
+	int fd = mkstemp(fn);
+	FILE *out = fd < 0 ? NULL : fdopen(fd, "w");
+	if (out == NULL) {
+		fprintf(stderr, "Cannot create a temporary trace: %s\n", strerror(errno));
+		exit(1);
+	}
+	t->generate(out, n);
+	fclose(out);
+}
+
+/*
+ * decode_trace:
+ * Decodes a whole trace file into memory and returns the accesses, storing
+ * how many in "*n".
+ */
+trace_access_t *decode_trace(char *fn, long long *n) {
+	long long cap = SWEEP_BATCH;
+	trace_access_t *accs = malloc(cap * sizeof(trace_access_t));
+	trace_reader_t *trace = trace_open(fn);
+	int got;
+
+	*n = 0;
+	if (accs == NULL) {
+		printf("Error: malloc failed");
+		exit(1);
+	}
+	while ((got = read_trace_batch(trace, accs + *n, cap - *n)) > 0) {
+		*n += got;
+		if (*n == cap) {
+			cap *= 2;
+			accs = realloc(accs, cap * sizeof(trace_access_t));
+			if (accs == NULL) {
+				printf("Error: malloc failed");
+				exit(1);
+			}
+		}
+	}
+	trace_close(trace);
+	return accs;
+}
+
+/*
+ * time_parse:
+ * Returns how long reading and decoding the trace file takes.
+ */
+double time_parse(char *fn) {
+	trace_access_t batch[SWEEP_BATCH / 16];
+	long long total = 0;
+	double start = now_sec();
+	trace_reader_t *trace = trace_open(fn);
+	int got;
+
+	while ((got = read_trace_batch(trace, batch, SWEEP_BATCH / 16)) > 0) {
+		total += got;
+	}
+	trace_close(trace);
+	assert(total > 0);
+	return now_sec() - start;
+}
+
+/*
+ * time_sim:
+ * Returns how long simulating the decoded accesses takes, starting from an
+ * empty cache.
+ */
+double time_sim(trace_access_t *accs, long long n) {
+	init_cache();
+	double start = now_sec();
+	for (long long i = 0; i < n; i++) {
+		trace_access_t *p = &accs[i];
+		if (p->op == 'S') {
+			access_data_rw(p->addr, 1, p->len);
+		} else if (p->op == 'L') {
+			access_data(p->addr);
+		} else if (p->op == 'M') {
+			access_data(p->addr);
+			access_data_rw(p->addr, 1, p->len);
+		}
+	}
+	double elapsed = now_sec() - start;
+	free_cache();
+	return elapsed;
+}
+
+/*
+ * time_end_to_end:
+ * Returns how long a full replay of the trace file takes.
+ */
+double time_end_to_end(char *fn) {
+	init_cache();
+	double start = now_sec();
+	replay_trace(fn);
+	double elapsed = now_sec() - start;
+	free_cache();
+	return elapsed;
+}
+
+/*
+ * parse_geometries:
+ * Parses "s:E:b,s:E:b,..." into "geo" and returns how many.
+ */
+int parse_geometries(char *spec, int geo[][3]) {
+	char *copy = strdup(spec);
+	char *save = NULL;
+	int n = 0;
+	char extra;
+
+	for (char *item = strtok_r(copy, ",", &save); item != NULL;
+			item = strtok_r(NULL, ",", &save)) {
+		if (n == MAX_BENCH_GEOMETRIES
+				|| sscanf(item, "%d:%d:%d%c", &geo[n][0], &geo[n][1], &geo[n][2], &extra) != 3
+				|| geo[n][0] < 0 || geo[n][1] < 1 || geo[n][2] < 0) {
+			fprintf(stderr, "Bad geometry \"%s\", expected s:E:b\n", item);
+			exit(1);
+		}
+		n++;
+	}
+	free(copy);
+	return n;
+}
+
+/*
+ * write_results:
+ * Writes the results as JSON, one result per line so that baselines are
+ * easy to read back and to diff.
+ */
+void write_results(FILE *out, long long accesses, double calibration, bench_result_t *res, int n) {
+	fprintf(out, "{\"accesses\":%lld,\"calibration\":%.0f,\"results\":[\n", accesses, calibration);
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "{\"trace\":\"%s\",\"s\":%d,\"E\":%d,\"b\":%d,"
+				"\"parse\":%.0f,\"sim\":%.0f,\"end_to_end\":%.0f}%s\n",
+				res[i].trace, res[i].s, res[i].E, res[i].b,
+				res[i].parse, res[i].sim, res[i].end_to_end, i + 1 < n ? "," : "");
+	}
+	fprintf(out, "]}\n");
+}
+
+/*
+ * read_results:
+ * Reads results written by write_results() and returns how many, storing
+ * the calibration speed in "*calibration".
+ */
+int read_results(char *fn, double *calibration, bench_result_t *res) {
+	char line[256];
+	int n = 0;
+	FILE *in = fopen(fn, "r");
+
+	if (in == NULL) {
+		fprintf(stderr, "Cannot open baseline %s: %s\n", fn, strerror(errno));
+		exit(1);
+	}
+	while (n < MAX_BENCH_RESULTS && fgets(line, sizeof(line), in) != NULL) {
+		bench_result_t *r = &res[n];
+		long long accesses;
+		if (sscanf(line, "{\"accesses\":%lld,\"calibration\":%lf", &accesses, calibration) == 2) {
+			continue;
+		}
+		if (sscanf(line, "{\"trace\":\"%15[^\"]\",\"s\":%d,\"E\":%d,\"b\":%d,"
+				"\"parse\":%lf,\"sim\":%lf,\"end_to_end\":%lf}",
+				r->trace, &r->s, &r->E, &r->b, &r->parse, &r->sim, &r->end_to_end) == 7) {
+			n++;
+		}
+	}
+	fclose(in);
+	return n;
+}
+
+/*
+ * check_regression:
+ * Reports one throughput that fell more than "tolerance" below its
+ * baseline. Returns 1 if it did.
+ */
+int check_regression(const bench_result_t *r, const char *what, double now, double base,
+		double tolerance) {
+	if (base <= 0 || now >= base * (1 - tolerance)) {
+		return 0;
+	}
+	fprintf(stderr, "REGRESSION %s s:%d E:%d b:%d %s: %.0f accesses/sec, scaled baseline %.0f (%.1f%%)\n",
+			r->trace, r->s, r->E, r->b, what, now, base, 100.0 * (now - base) / base);
+	return 1;
+}
+
+//Accesses per trace in the -x checks.
+#define CHECK_ACCESSES 20000
+
+/*
+ * gen_check_core:
+ * 8 byte loads and stores at offset 12 of random 16 byte blocks in a 64KB
+ * region at "base", so with b=4 every access crosses a block.
+ */
+void gen_check_core(FILE *out, long long n, mem_addr_t base) {
+	unsigned long long x = 0x9e3779b97f4a7c15ULL;
+
+	for (long long i = 0; i < n; i++) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		unsigned long long r = x * 0x2545f4914f6cdd1dULL;
+		fprintf(out, " %c %llx,8\n", i % 2 ? 'S' : 'L', base + ((r >> 8) % 4096) * 16 + 12);
+	}
+}
+
+/*
+ * gen_check_core0, gen_check_core1:
+ * The same pattern for two cores, 1MB apart, so that with private caches
+ * both cores see about the same hits and misses.
+ */
+void gen_check_core0(FILE *out, long long n) {
+	gen_check_core(out, n, 0x10000000ULL);
+}
+
+void gen_check_core1(FILE *out, long long n) {
+	gen_check_core(out, n, 0x10100000ULL);
+}
+
+/*
+ * gen_check_stride:
+ * One load instruction walking memory 72 bytes at a time; half of its
+ * 8 byte loads cross a 16 byte block.
+ */
+void gen_check_stride(FILE *out, long long n) {
+	for (long long i = 0; i < n; i++) {
+		fprintf(out, "I  400100,4\n L %llx,8\n", 0x10000000ULL + i * 72 + 12);
+	}
+}
+
+/*
+ * check_run_coherence:
+ * Child of run_captured(): two cores of s=4 E=2 b=4 over the traces in
+ * "arg" with a shared LLC.
+ */
+void check_run_coherence(char *arg) {
+	s = 4;
+	E = 2;
+	b = 4;
+	coherence_trace(arg, INTERLEAVE_RR, "8:4:4", 1, 0);
+}
+
+/*
+ * check_run_prefetch:
+ * Child of run_captured(): a two level hierarchy with a stride prefetcher
+ * at L1 over the trace in "arg".
+ */
+void check_run_prefetch(char *arg) {
+	char spec[] = "4:2:4,6:4:4";
+	char prefetch[] = "stride";
+	hier_trace(arg, spec, INCLUSION_NINE, prefetch);
+}
+
+/*
+ * run_captured:
+ * Runs "fn" on "arg" in a child process with -l on or off, and stores what
+ * it prints in "out" (at most "cap" bytes, NUL terminated). The child keeps
+ * the simulator's globals from leaking into the next check.
+ */
+void run_captured(void (*fn)(char *), char *arg, int split, char *out, size_t cap) {
+	FILE *tmp = tmpfile();
+	if (tmp == NULL) {
+		fprintf(stderr, "Cannot create a temporary file: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "Cannot fork: %s\n", strerror(errno));
+		exit(1);
+	}
+	if (pid == 0) {
+		dup2(fileno(tmp), STDOUT_FILENO);
+		split_blocks = split;
+		fn(arg);
+		fflush(stdout);
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+
+	rewind(tmp);
+	size_t got = fread(out, 1, cap - 1, tmp);
+	out[got] = '\0';
+	fclose(tmp);
+}
+
+/*
+ * check_coherence_split:
+ * -M with -l must charge every piece of a split access to the core it
+ * came from: each core makes two accesses per record, and the symmetric
+ * cores miss about equally. Returns the number of failures.
+ */
+int check_coherence_split() {
+	bench_trace_t core0 = { "core0", gen_check_core0 };
+	bench_trace_t core1 = { "core1", gen_check_core1 };
+	char fn0[32], fn1[32], list[72], out[8192];
+	int failures = 0;
+
+	generate_trace(&core0, CHECK_ACCESSES, fn0);
+	generate_trace(&core1, CHECK_ACCESSES, fn1);
+	for (int split = 0; split <= 1; split++) {
+		long long hits[2] = { 0, 0 }, misses[2] = { 0, 0 };
+		long long want = CHECK_ACCESSES * (split ? 2 : 1);
+
+		snprintf(list, sizeof(list), "%s,%s", fn0, fn1);
+		run_captured(check_run_coherence, list, split, out, sizeof(out));
+		for (char *line = strtok(out, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+			int core;
+			long long h, m;
+			if (sscanf(line, "core %d (s:%*d E:%*d b:%*d) hits:%lld misses:%lld", &core, &h, &m) == 3
+					&& core >= 0 && core < 2) {
+				hits[core] = h;
+				misses[core] = m;
+			}
+		}
+		for (int core = 0; core < 2; core++) {
+			if (hits[core] + misses[core] != want) {
+				fprintf(stderr, "check coherence%s: core %d made %lld accesses, expected %lld\n",
+						split ? " -l" : "", core, hits[core] + misses[core], want);
+				failures++;
+			}
+		}
+		if (llabs(misses[0] - misses[1]) > want / 100) {
+			fprintf(stderr, "check coherence%s: core misses %lld and %lld differ by over 1%%\n",
+					split ? " -l" : "", misses[0], misses[1]);
+			failures++;
+		}
+	}
+	unlink(fn0);
+	unlink(fn1);
+	return failures;
+}
+
+/*
+ * check_prefetch_split:
+ * A stride prefetcher must still follow one instruction's stride when -l
+ * cuts its accesses into pieces. Returns the number of failures.
+ */
+int check_prefetch_split() {
+	bench_trace_t stride = { "stride", gen_check_stride };
+	char fn[32], out[8192];
+	long long issued[2] = { 0, 0 };
+	int failures = 0;
+
+	generate_trace(&stride, CHECK_ACCESSES, fn);
+	for (int split = 0; split <= 1; split++) {
+		run_captured(check_run_prefetch, fn, split, out, sizeof(out));
+		char *line = strstr(out, "L1 prefetch:stride:");
+		if (line == NULL || sscanf(line, "L1 prefetch:stride:%*d issued:%lld", &issued[split]) != 1) {
+			fprintf(stderr, "check prefetch%s: no prefetch statistics\n", split ? " -l" : "");
+			failures++;
+		}
+	}
+	if (issued[0] < CHECK_ACCESSES * 9 / 10 || issued[1] < issued[0] * 9 / 10) {
+		fprintf(stderr, "check prefetch: %lld prefetches without -l, %lld with -l, expected about %d\n",
+				issued[0], issued[1], CHECK_ACCESSES);
+		failures++;
+	}
+	unlink(fn);
+	return failures;
+}
+
+/*
+ * run_checks:
+ * Runs every mode check and returns the number of failures.
+ */
+int run_checks() {
+	int failures = check_coherence_split() + check_prefetch_split();
+	if (failures > 0) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	} else {
+		fprintf(stderr, "All checks passed\n");
+	}
+	return failures;
+}
+
+/*
+ * print_bench_usage:
+ * Prints information on how to use the benchmark.
+ */
+void print_bench_usage(char* argv[]) {
+	printf("Usage: %s [-h] [-n <num>] [-g <list>] [-r <num>] [-B <file> [-u] [-T <pct>]]\n", argv[0]);
+	printf("       %s -x\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -n <num>   Accesses per synthetic trace (default 1000000).\n");
+	printf("  -g <list>  Geometries as s:E:b,... (default %s).\n", BENCH_GEOMETRIES);
+	printf("  -r <num>   Repetitions, the fastest one counts (default 5).\n");
+	printf("  -B <file>  Baseline JSON to compare against.\n");
+	printf("  -u         Write this run to the baseline file instead.\n");
+	printf("  -T <pct>   Allowed slowdown before a regression (default 25).\n");
+	printf("  -x         Run the mode checks instead of timing.\n");
+	printf("\nExample:\n");
+	printf("  linux>  %s -B csim_bench_baseline.json\n", argv[0]);
+}
+
+int main(int argc, char* argv[]) {
+	long long accesses = 1000000;
+	char *geo_spec = BENCH_GEOMETRIES;
+	char *baseline = NULL;
+	int update = 0;
+	int reps = 5;
+	double tolerance = 0.25;
+	char c;
+
+	while ((c = getopt(argc, argv, "n:g:r:B:uT:xh")) != -1) {
+		switch (c) {
+			case 'x':
+				return run_checks() > 0;
+			case 'n':
+				accesses = atoll(optarg);
+				break;
+			case 'g':
+				geo_spec = optarg;
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'B':
+				baseline = optarg;
+				break;
+			case 'u':
+				update = 1;
+				break;
+			case 'T':
+				tolerance = atof(optarg) / 100;
+				break;
+			case 'h':
+				print_bench_usage(argv);
+				exit(0);
+			default:
+				print_bench_usage(argv);
+				exit(1);
+		}
+	}
+	if (accesses < 1 || reps < 1 || (update && baseline == NULL)) {
+		print_bench_usage(argv);
+		exit(1);
+	}
+
+	double calibration = 0;
+	for (int r = 0; r < reps; r++) {
+		double speed = calibrate();
+		if (speed > calibration) calibration = speed;
+	}
+
+	int geo[MAX_BENCH_GEOMETRIES][3];
+	int num_geo = parse_geometries(geo_spec, geo);
+	bench_result_t results[MAX_BENCH_RESULTS];
+	int num_results = 0;
+
+	for (int t = 0; t < NUM_BENCH_TRACES; t++) {
+		char fn[32];
+		long long n;
+		double parse = 0;
+
+		generate_trace(&bench_traces[t], accesses, fn);
+		trace_access_t *accs = decode_trace(fn, &n);
+		for (int r = 0; r < reps; r++) {
+			double elapsed = time_parse(fn);
+			if (r == 0 || elapsed < parse) parse = elapsed;
+		}
+
+		for (int g = 0; g < num_geo && num_results < MAX_BENCH_RESULTS; g++) {
+			double sim_time = 0, e2e_time = 0;
+			s = geo[g][0];
+			E = geo[g][1];
+			b = geo[g][2];
+			for (int r = 0; r < reps; r++) {
+				double elapsed = time_sim(accs, n);
+				if (r == 0 || elapsed < sim_time) sim_time = elapsed;
+				elapsed = time_end_to_end(fn);
+				if (r == 0 || elapsed < e2e_time) e2e_time = elapsed;
+			}
+
+			bench_result_t *res = &results[num_results++];
+			snprintf(res->trace, sizeof(res->trace), "%s", bench_traces[t].name);
+			res->s = s;
+			res->E = E;
+			res->b = b;
+			res->parse = n / parse;
+			res->sim = n / sim_time;
+			res->end_to_end = n / e2e_time;
+		}
+
+		free(accs);
+		unlink(fn);
+	}
+
+	write_results(stdout, accesses, calibration, results, num_results);
+
+	if (baseline == NULL) {
+		return 0;
+	}
+	if (update) {
+		FILE *out = fopen(baseline, "w");
+		if (out == NULL) {
+			fprintf(stderr, "Cannot write baseline %s: %s\n", baseline, strerror(errno));
+			exit(1);
+		}
+		write_results(out, accesses, calibration, results, num_results);
+		fclose(out);
+		return 0;
+	}
+
+	bench_result_t base[MAX_BENCH_RESULTS];
+	double base_calibration = 0;
+	int num_base = read_results(baseline, &base_calibration, base);
+	double scale = base_calibration > 0 ? calibration / base_calibration : 1;
+	int regressions = 0;
+	for (int i = 0; i < num_results; i++) {
+		bench_result_t *r = &results[i];
+		for (int j = 0; j < num_base; j++) {
+			bench_result_t *o = &base[j];
+			if (strcmp(r->trace, o->trace) == 0 && r->s == o->s && r->E == o->E && r->b == o->b) {
+				regressions += check_regression(r, "parse", r->parse, o->parse * scale, tolerance);
+				regressions += check_regression(r, "sim", r->sim, o->sim * scale, tolerance);
+				regressions += check_regression(r, "end_to_end", r->end_to_end,
+						o->end_to_end * scale, tolerance);
+				break;
+			}
+		}
+	}
+	if (regressions > 0) {
+		fprintf(stderr, "%d regression(s) against %s\n", regressions, baseline);
+		return 1;
+	}
+	fprintf(stderr, "No regressions against %s\n", baseline);
+	return 0;
+}